@@ -0,0 +1,126 @@
+; -----------------------------------------------------------------------------
+; ZX7 decoder for p2rom, after "dzx7_standard" by Einar Saukas, Antonio Villena
+; & Metalbrain
+; "Mega" version: every bit read is inlined and refills its bit buffer in a
+; block of its own, which jumps back to where the bit is tested
+; -----------------------------------------------------------------------------
+; Parameters:
+;   HL: source address (compressed data)
+;   DE: destination address (decompressing)
+; -----------------------------------------------------------------------------
+
+dzx7_mega:
+        ld      a, $80
+dzx7m_copy_byte_loop:
+        ldi                             ; copy literal byte
+dzx7m_main_loop:
+        add     a, a                    ; check next bit
+        jr      z, dzx7m_load_main      ; no more bits left?
+        jr      nc, dzx7m_copy_byte_loop ; next bit indicates either literal or sequence
+
+; determine number of bits used for length (Elias gamma coding)
+dzx7m_sequence:
+        push    de
+        ld      bc, 1
+        ld      d, b
+dzx7m_len_size_loop:
+        inc     d
+        add     a, a                    ; check next bit
+        jr      z, dzx7m_load_size      ; no more bits left?
+        jr      nc, dzx7m_len_size_loop
+
+; determine length
+dzx7m_len_value_start:
+        dec     d
+        jr      z, dzx7m_len_value_end
+dzx7m_len_value_loop:
+        add     a, a                    ; check next bit
+        jr      z, dzx7m_load_value     ; no more bits left?
+dzx7m_len_value_bit:
+        rl      c
+        rl      b
+        jr      c, dzx7m_exit           ; check end marker
+        dec     d
+        jr      nz, dzx7m_len_value_loop
+dzx7m_len_value_end:
+        inc     bc                      ; adjust length
+
+; determine offset
+        ld      e, (hl)                 ; load offset flag (1 bit) + offset value (7 bits)
+        inc     hl
+        defb    $cb, $33                ; opcode for undocumented instruction "SLL E" aka "SLS E"
+        jr      nc, dzx7m_offset_end    ; if offset flag is set, load 4 extra bits
+        add     a, a                    ; check next bit
+        jr      z, dzx7m_load_offset1   ; no more bits left?
+dzx7m_offset_bit1:
+        rl      d                       ; insert first bit into D
+        add     a, a                    ; check next bit
+        jr      z, dzx7m_load_offset2   ; no more bits left?
+dzx7m_offset_bit2:
+        rl      d                       ; insert second bit into D
+        add     a, a                    ; check next bit
+        jr      z, dzx7m_load_offset3   ; no more bits left?
+dzx7m_offset_bit3:
+        rl      d                       ; insert third bit into D
+        add     a, a                    ; check next bit
+        jr      z, dzx7m_load_offset4   ; no more bits left?
+dzx7m_offset_bit4:
+        ccf
+        jr      c, dzx7m_offset_end
+        inc     d                       ; equivalent to adding 128 to DE
+dzx7m_offset_end:
+        rr      e                       ; insert inverted fourth bit into E
+
+; copy previous sequence
+        ex      (sp), hl                ; store source, restore destination
+        push    hl                      ; store destination
+        sbc     hl, de                  ; HL = destination - offset - 1
+        pop     de                      ; DE = destination
+        ldir
+        pop     hl                      ; restore source address (compressed data)
+        jp      dzx7m_main_loop         ; carry is clear after SBC
+
+dzx7m_exit:
+        pop     hl                      ; HL = end of the decompressed data
+        ret
+
+; load another group of 8 bits, then take the branch the bit selects
+dzx7m_load_main:
+        ld      a, (hl)
+        inc     hl
+        rla
+        jr      nc, dzx7m_copy_byte_loop
+        jr      dzx7m_sequence
+dzx7m_load_size:
+        ld      a, (hl)
+        inc     hl
+        rla
+        jr      nc, dzx7m_len_size_loop
+        jr      dzx7m_len_value_start
+dzx7m_load_value:
+        ld      a, (hl)
+        inc     hl
+        rla
+        jr      dzx7m_len_value_bit
+dzx7m_load_offset1:
+        ld      a, (hl)
+        inc     hl
+        rla
+        jr      dzx7m_offset_bit1
+dzx7m_load_offset2:
+        ld      a, (hl)
+        inc     hl
+        rla
+        jr      dzx7m_offset_bit2
+dzx7m_load_offset3:
+        ld      a, (hl)
+        inc     hl
+        rla
+        jr      dzx7m_offset_bit3
+dzx7m_load_offset4:
+        ld      a, (hl)
+        inc     hl
+        rla
+        jr      dzx7m_offset_bit4
+
+; -----------------------------------------------------------------------------
@@ -1,4 +1,5 @@
 ; loader.asm (build as raw binary located at ORG 0x2000)
+; sjasmplus loader.asm [-DDZX7_TURBO | -DDZX7_MEGA] --raw=loader.bin
         ORG     $2000
 
 BOOT:
@@ -9,7 +10,7 @@ BOOT:
         ld      de, $4009
 
         ; decompress
-        call    dzx7_standard
+        call    dzx7
 
         ; set sys vars
         ld      (iy+0),$ff      ; ERR_NR = $FF
@@ -19,7 +20,16 @@ BOOT:
         jp      $0f2b           ; exit via SLOW -> LINERUN ($0676)
 
 
+dzx7:   ; -DDZX7_TURBO or -DDZX7_MEGA selects a faster, larger decoder
+        IFDEF DZX7_MEGA
+        include "dzx7_mega.asm"
+        ELSE
+        IFDEF DZX7_TURBO
+        include "dzx7_turbo.asm"
+        ELSE
         include "dzx7_standard.asm"
+        ENDIF
+        ENDIF
 
 COMPRESSED_START:
         ; The actual data is added by p2bin
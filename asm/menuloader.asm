@@ -1,4 +1,5 @@
 ; build as raw binary located at ORG 0x2000
+; sjasmplus menuloader.asm [-DDZX7_TURBO | -DDZX7_MEGA] --raw=menuloader.bin
 
 	org 0x2000
 BOOT:
@@ -104,7 +105,7 @@ wait_for_key:
     ld      de, $4009
 
     ; decompress
-    call    dzx7_standard
+    call    dzx7
 
     ; set sys vars
     ld      (iy+0),$ff      ; ERR_NR = $FF
@@ -113,7 +114,16 @@ wait_for_key:
     ld      (iy+1),$c0      ; FLAGS reset
     jp      $0f2b           ; exit via SLOW -> LINERUN ($0676)
 
-    include "dzx7_standard.asm"
+dzx7:   ; -DDZX7_TURBO or -DDZX7_MEGA selects a faster, larger decoder
+        IFDEF DZX7_MEGA
+        include "dzx7_mega.asm"
+        ELSE
+        IFDEF DZX7_TURBO
+        include "dzx7_turbo.asm"
+        ELSE
+        include "dzx7_standard.asm"
+        ENDIF
+        ENDIF
 
 MENU:	;non terminated menu ("PRESS B OR 1-"). Must be terminated with $9
 	db $35, $37, $2A, $38, $38, $00, $27, $00, $34, $37, $00, $1D, $16
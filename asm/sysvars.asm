@@ -0,0 +1,30 @@
+; sysvars.asm - the sysvar dictionary primer, for reference
+; p2rom --sysvar-dict assembles this in place (sysvars.cpp): after the
+; single-file loader, or before the menu prompt, with the loader's CALL dzx7
+; pointed at it and TEMPLATE followed by the compressed sysvar template.
+;
+; The program's stream was compressed with the 116-byte template in front of
+; it, so it is decoded right after a copy of the template and then moved down
+; to VERSN. Costs about 21 T-states per program byte for the move.
+
+primer:                                 ; HL = program stream
+        push    hl
+        ld      hl, TEMPLATE
+        ld      de, $4009
+        call    dzx7                    ; template to $4009-$407C
+        pop     hl
+        ld      de, $407D
+        call    dzx7                    ; program after it, matching into it
+
+        ld      hl, ($4014+116)         ; the program's E_LINE
+        ld      bc, -$4009
+        add     hl, bc
+        ld      b, h
+        ld      c, l                    ; BC = bytes up to E_LINE, as LOAD reads them
+        ld      hl, $407D
+        ld      de, $4009
+        ldir                            ; down over the template
+        ret
+
+TEMPLATE:
+        ; ZX7 stream of the template, added by p2rom
@@ -1,7 +1,9 @@
-// build_zx81_rom.cpp
+// build_zx81_rom.cpp - p2rom, the command line over libp2rom (rombuilder.h)
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <cstdint>
+#include <cmath>
 #include <vector>
 #include <string>
 #include <fstream>
@@ -11,388 +13,679 @@
 #include <algorithm>
 #include <cctype>
 #include <cstddef>
+#include <map>
+#include <mutex>
+#include <iomanip>
+#include <chrono>
+#include <set>
+#include <functional>
 
 #include <unistd.h>   // getopt
+#include <getopt.h>
 #include <sys/stat.h>
-#include "base.h"
-#include "loader.h"
-#include "menuloader.h"  // New header for menu loader
+#include "parallel.h"
+#include "rombuilder.h"
+#include "watch.h"
 
-extern "C" {
-    #include "zx7/zx7.h"
+static std::string derive_output_name(const std::vector<std::string>& p_paths) {
+    if (p_paths.size() == 1) {
+        return program_name(p_paths[0]) + ".rom";
+    } else {
+        return "multi.rom";  // Default name for multi-file ROM
+    }
 }
 
-struct CompressedPFile {
-    std::string original_name;
-    std::vector<uint8_t> compressed_data;
-    size_t offset;  // Offset in ROM where this P-file is stored
-};
-
-std::vector<unsigned char> zx7_encode(const std::vector<unsigned char>& raw) {
-    if (raw.empty()) throw std::runtime_error("empty input");
-
-    std::vector<unsigned char> buf = raw;
+static bool file_exists(const char* p) {
+    struct stat st{};
+    return p && *p && (stat(p, &st) == 0) && S_ISREG(st.st_mode);
+}
 
-    long  skip  = 0;
-    long  delta = 0;
-    size_t out_sz = 0;
 
-    Optimal* opt = optimize(buf.data(), buf.size(), skip); 
-    unsigned char* out = compress(opt, buf.data(), buf.size(),
-                                  skip, &out_sz, &delta);
-    if (!out || out_sz == 0) {
-        if (opt) free(opt);
-        throw std::runtime_error("ZX7 compress failed");
+// Paths to files that don't exist fall back to the embedded base ROM and
+// loader, as they always have; only a forced menu loader has to be there
+static RomSpec resolve_paths(RomSpec spec) {
+    if (!file_exists(spec.base_path.c_str())) spec.base_path.clear();
+    if (!file_exists(spec.loader_path.c_str()) && !(spec.inputs.size() > 1 && spec.force_loader)) {
+        spec.loader_path.clear();
     }
-    std::vector<unsigned char> res(out, out + out_sz);
-    free(out);
-    free(opt);
-    return res;
+    return spec;
 }
 
-static std::vector<uint8_t> slurp(const std::string& path) {
-    std::ifstream f(path, std::ios::binary);
-    if (!f) { throw std::runtime_error("Cannot open: " + path); }
-    std::vector<uint8_t> data((std::istreambuf_iterator<char>(f)),
-                               std::istreambuf_iterator<char>());
-    return data;
+// A single file uses the loader it is given; a menu only a forced one
+static bool uses_loader_file(const RomSpec& spec) {
+    return !spec.loader_path.empty() && (spec.inputs.size() == 1 || spec.force_loader);
 }
 
-static bool ends_with_case_insensitive(const std::string& s, const std::string& suffix) {
-    if (s.size() < suffix.size()) return false;
-    for (size_t i = 0; i < suffix.size(); ++i) {
-        char a = std::tolower((unsigned char)s[s.size() - suffix.size() + i]);
-        char b = std::tolower((unsigned char)suffix[i]);
-        if (a != b) return false;
+// Files mapped (or with map = false, read) on first use and kept until the
+// batch is done; safe to use from several threads at once
+class MappedFiles {
+public:
+    explicit MappedFiles(bool map) : map_(map) {}
+
+    ByteView get(const std::string& path) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = files_.find(path);
+        if (it == files_.end()) it = files_.emplace(path, MappedFile(path, map_)).first;
+        return it->second.bytes();
     }
-    return true;
-}
 
-static bool is_zx7(const std::string& inputPath) {
-    return ends_with_case_insensitive(inputPath, ".zx7");
+private:
+    const bool map_;
+    std::mutex mutex_;
+    std::map<std::string, MappedFile> files_;
+};
+
+static RomBuilder make_builder(const EncoderOptions& options, unsigned jobs, const CompressionCache& cache,
+                               bool verify, BuildStats& stats) {
+    RomBuilder builder(options, jobs);
+    builder.set_cache(&cache);
+    builder.set_stats(&stats);
+    builder.set_verify(verify);
+    return builder;
 }
 
-static std::vector<uint8_t> load_embedded_base() {
-    return std::vector<uint8_t>(base8k_rom, base8k_rom + base8k_rom_len);
+static void write_bank_map(const std::string& path, const RomSpec& spec, const RomReport& report) {
+    std::ofstream map(path);
+    map << "# " << spec.output << ": " << spec.eprom_banks << " x 16K banks, "
+        << report.banks.size() << " used\n";
+    for (size_t b = 0; b < spec.eprom_banks; b++) {
+        map << "bank " << b << "  0x" << std::hex << std::setfill('0') << std::setw(5) << b * BANK_SIZE
+            << "-0x" << std::setw(5) << (b + 1) * BANK_SIZE - 1 << std::dec << std::setfill(' ');
+        if (b >= report.banks.size()) {
+            map << "  empty\n";
+            continue;
+        }
+        const BankReport& bank = report.banks[b];
+        map << "  " << (bank.programs.size() > 1 ? "menu" : "single") << "  used " << bank.used()
+            << " / 8192  free " << 8192 - bank.used() << "  dzx7_" << decoder_name(bank.decoder) << "\n";
+        for (size_t k = 0; k < bank.programs.size(); k++) {
+            const ProgramReport& program = report.programs[bank.programs[k]];
+            map << "  " << (k + 1) << "  0x" << std::hex << program.offset << std::dec << "  "
+                << std::setw(6) << program.compressed << "  " << program.name << "\n";
+        }
+    }
+    if (!map) throw std::runtime_error("Could not write bank map " + path);
 }
 
-static std::vector<uint8_t> load_embedded_loader() {
-    return std::vector<uint8_t>(loader_bin, loader_bin + loader_bin_len);
+// Writes a built image, and its bank map for an EPROM
+static void write_rom(const RomSpec& spec, const RomResult& result, BuildStats& stats) {
+    BuildStats::Stage timing(stats, "write", spec.output);
+    replace_file(spec.output, result.image);
+    if (spec.eprom_banks) write_bank_map(spec.output + ".map", spec, result.report);
 }
 
-static std::vector<uint8_t> load_embedded_menuloader() {
-    return std::vector<uint8_t>(menuloader_bin, menuloader_bin + menuloader_bin_len);
+// Builds a single ROM with the detailed [info] log; map = false reads the
+// files instead of mapping them (see MappedFile)
+static int build_single(const RomSpec& rom_spec, const EncoderOptions& options, unsigned jobs,
+                        const CompressionCache& cache, bool verify, bool map, BuildStats& build_stats,
+                        std::ostream& log) {
+    const RomSpec spec = resolve_paths(rom_spec);
+    MappedFile base_file, loader_file;
+    {
+        BuildStats::Stage timing(build_stats, "load", spec.output);
+        if (!spec.base_path.empty()) base_file = MappedFile(spec.base_path, map);
+        if (uses_loader_file(spec)) loader_file = MappedFile(spec.loader_path, map);
+    }
+    std::vector<MappedFile> files(spec.inputs.size());
+    std::vector<ByteView> inputs;
+    for (size_t i = 0; i < spec.inputs.size(); i++) {
+        BuildStats::Stage timing(build_stats, "read", spec.inputs[i]);
+        files[i] = MappedFile(spec.inputs[i], map);
+        inputs.push_back(files[i].bytes());
+    }
+
+    RomBuilder builder = make_builder(options, jobs, cache, verify, build_stats);
+    builder.set_log(&log);
+    const RomResult result = builder.build(spec, inputs, base_file.bytes(), loader_file.bytes());
+    write_rom(spec, result, build_stats);
+
+    const RomReport& report = result.report;
+    if (spec.eprom_banks) {
+        size_t payload = 0;
+        for (const auto& program : report.programs) payload += program.compressed;
+        log << "OK → " << spec.output << "  (bank map: " << spec.output << ".map)\n"
+            << "  EPROM: " << spec.eprom_banks << " x 16K banks, " << report.banks.size() << " used\n"
+            << "  P-files: " << report.programs.size() << " files, " << payload << " bytes total\n";
+        return 0;
+    }
+
+    // Summary
+    const BankReport& bank = report.banks[0];
+    const bool use_menu = report.programs.size() > 1;
+    size_t used_upper = bank.used();
+    size_t free_upper = 8192 - used_upper;
+    
+    log << "OK → " << spec.output << "\n"
+        << "  Base:  " << (!spec.base_path.empty() ? spec.base_path : "[embedded]") << "  (8192 bytes)\n"
+        << "  Loader: " << (bank.custom_loader ? spec.loader_path : use_menu ? "[embedded menu]" : "[embedded single]")
+        << " (" << bank.loader << " bytes)\n";
+    
+    if (use_menu && bank.menu > 0) {
+        log << "  Filenames: " << bank.menu << " bytes\n";
+    }
+    
+    uint64_t slowest = 0;
+    for (const auto& program : report.programs) slowest = std::max(slowest, program.decode_tstates);
+
+    log << "  P-files: " << report.programs.size() << " files, " << bank.payload << " bytes total\n"
+        << "  Upper-block: Used " << used_upper << " / 8192 bytes  (free " << free_upper << ")\n"
+        << "  Decompression: dzx7_" << decoder_name(bank.decoder) << ", " << slowest << " T-states"
+        << (use_menu ? " for the slowest program" : "")
+        << " (" << std::fixed << std::setprecision(1) << slowest / 3250.0 << std::defaultfloat << " ms at 3.25 MHz)\n";
+
+    if (use_menu) {
+        log << "\nP-file offsets for menu loader:\n";
+        for (const auto& program : report.programs) {
+            log << "  " << program.name << ": 0x" << std::hex << program.offset << std::dec << "\n";
+        }
+    }
+    return 0;
 }
 
-static std::string basename_no_ext(const std::string& path) {
-    auto slash = path.find_last_of("/\\");
-    std::string name = (slash == std::string::npos) ? path : path.substr(slash + 1);
-    auto dot = name.find_last_of('.');
-    if (dot != std::string::npos) name.resize(dot);
-    if (name.size() > 2 && name.compare(name.size()-2, 2, ".p") == 0) {
-        name.resize(name.size()-2);
+// Builds every ROM of a manifest in one process: each distinct input is read
+// and compressed once, images are laid out and written in parallel, and the
+// result is reported as one table
+static int build_batch(const std::vector<RomSpec>& rom_specs, const EncoderOptions& options, unsigned jobs,
+                       const CompressionCache& cache, bool verify, bool map, BuildStats& build_stats,
+                       std::ostream& log) {
+    std::vector<RomSpec> roms;
+    for (const auto& spec : rom_specs) roms.push_back(resolve_paths(spec));
+
+    MappedFiles files(map);
+    RomBuilder builder = make_builder(options, jobs, cache, verify, build_stats);
+    builder.set_log(&log);
+    const BatchReport batch = builder.build_all(
+        roms, [&](const std::string& path) { return files.get(path); },
+        [&](size_t r, RomResult& result) {
+            write_rom(roms[r], result, build_stats);
+            std::vector<uint8_t>().swap(result.image);
+        });
+
+    size_t name_width = 3;
+    for (const auto& spec : roms) name_width = std::max(name_width, spec.output.size());
+
+    log << std::left << std::setw((int)name_width) << "ROM" << std::right
+        << std::setw(7) << "Files" << std::setw(8) << "Loader" << std::setw(10) << "Decoder" << std::setw(7) << "Menu"
+        << std::setw(9) << "Payload" << std::setw(7) << "Used" << std::setw(7) << "Free"
+        << std::setw(11) << "Decode T" << "  Status\n";
+    int failed = 0;
+    for (size_t r = 0; r < roms.size(); r++) {
+        const RomReport& report = batch.roms[r];
+        const std::string& error = batch.errors[r];
+        size_t payload = 0;
+        uint64_t decode = 0;  // T-states to decode every payload once
+        for (const auto& program : report.programs) {
+            payload += program.compressed;
+            decode += program.decode_tstates;
+        }
+        log << std::left << std::setw((int)name_width) << roms[r].output << std::right
+            << std::setw(7) << roms[r].inputs.size();
+        if (error.empty() && report.eprom_banks) {
+            log << std::setw(8) << "-" << std::setw(10) << "-" << std::setw(7) << "-" << std::setw(9) << payload
+                << std::setw(7) << "-" << std::setw(7) << "-" << std::setw(11) << decode
+                << "  OK (" << report.banks.size() << "/"
+                << roms[r].eprom_banks << " banks)\n";
+        } else if (error.empty()) {
+            const BankReport& bank = report.banks[0];
+            log << std::setw(8) << bank.loader << std::setw(10) << decoder_name(bank.decoder)
+                << std::setw(7) << bank.menu
+                << std::setw(9) << bank.payload << std::setw(7) << bank.used()
+                << std::setw(7) << (8192 - bank.used()) << std::setw(11) << decode << "  OK\n";
+        } else {
+            log << std::setw(8) << "-" << std::setw(10) << "-" << std::setw(7) << "-" << std::setw(9) << "-"
+                << std::setw(7) << "-" << std::setw(7) << "-" << std::setw(11) << "-"
+                << "  FAILED: " << error << "\n";
+            failed++;
+        }
     }
+    log << roms.size() << " ROM(s), " << (roms.size() - failed) << " written; "
+        << batch.inputs << " input(s): " << batch.compressed << " compressed, " << batch.cached
+        << " from cache, " << batch.shared << " shared";
+    if (batch.workers) log << "; compressor peak " << batch.peak_bytes << " bytes";
+    log << "\n";
 
-    return name;
+    return failed ? 2 : 0;
 }
 
-static std::string derive_output_name(const std::vector<std::string>& p_paths) {
-    if (p_paths.size() == 1) {
-        return basename_no_ext(p_paths[0]) + ".rom";
-    } else {
-        return "multi.rom";  // Default name for multi-file ROM
+// The files a build of spec reads, for --watch
+static void watch_spec(const RomSpec& spec, FileWatcher& watcher) {
+    for (const auto& path : spec.inputs) watcher.add(path);
+    if (file_exists(spec.base_path.c_str())) watcher.add(spec.base_path);
+    if (file_exists(spec.loader_path.c_str())) watcher.add(spec.loader_path);
+}
+
+// --watch: builds, then rebuilds whenever a file the last build read changes.
+// The compression cache keeps every stream in memory, so a rebuild compresses
+// only the programs that changed; layout and patching are redone from scratch
+// and the image is replaced atomically. A failed build (say, a P-file caught
+// half written) is reported and the watch goes on. The files are read rather
+// than mapped, since an editor or emulator saving one with O_TRUNC during a
+// build would turn a read of a mapped page into SIGBUS.
+static int watch_builds(const std::function<int(FileWatcher&)>& build, std::ostream& log) {
+    FileWatcher watcher;
+    for (;;) {
+        watcher.clear();
+        auto start = std::chrono::steady_clock::now();
+        int status;
+        try {
+            status = build(watcher);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            status = 2;
+        }
+        if (watcher.empty()) return status;
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        log << "[watch] " << (status == 0 ? "Built" : "Build failed") << " in " << std::fixed << std::setprecision(1)
+            << us / 1000.0 << std::defaultfloat << " ms; waiting for changes (Ctrl-C to stop)\n" << std::flush;
+
+        for (const auto& path : watcher.wait(50)) log << "[watch] Changed: " << path << "\n";
     }
 }
 
-static bool file_exists(const char* p) {
-    struct stat st{};
-    return p && *p && (stat(p, &st) == 0) && S_ISREG(st.st_mode);
+// Writes every program in a ROM or EPROM image to dir as NAME.p
+static int extract_rom(const std::string& path, const std::string& dir) {
+    MappedFile file(path);
+    const ByteView image = file.bytes();
+    if (image.empty() || image.size() % BANK_SIZE) throw std::runtime_error(path + " is not a 16K ROM or EPROM image");
+    const size_t banks = image.size() / BANK_SIZE;
+    if (!dir.empty() && dir != ".") mkdir(dir.c_str(), 0777);
+
+    std::set<std::string> used;
+    size_t written = 0;
+    for (size_t b = 0; b < banks; b++) {
+        const uint8_t* rom = image.data() + b * BANK_SIZE;
+        if (std::all_of(rom + 0x2000, rom + BANK_SIZE, [](uint8_t v) { return v == 0xFF; })) continue;
+
+        RecoveredBank bank;
+        try {
+            bank = recover_bank(rom);
+        } catch (const std::exception& e) {
+            std::cout << "[warning] Bank " << b << ": " << e.what() << ", skipped\n";
+            continue;
+        }
+        const std::vector<FoundProgram>& programs = bank.programs;
+        std::cout << "[info] Bank " << b << ": " << (programs.size() > 1 ? "menu" : "single-file")
+                  << " loader (dzx7_" << decoder_name(bank.decoder) << (bank.sysvar_dict ? ", sysvar dictionary" : "")
+                  << "), " << programs.size() << " program(s)\n";
+
+        for (size_t k = 0; k < programs.size(); k++) {
+            const FoundProgram& p = programs[k];
+            if (p.offset < 0x2000 || p.offset >= BANK_SIZE) {
+                throw std::runtime_error("bank " + std::to_string(b) + ": program " + std::to_string(k + 1)
+                                         + " points outside the upper 8K");
+            }
+
+            // File name: the menu entry, else the image name with bank and entry
+            std::string name = p.name;
+            for (char& c : name) c = (c == '/' || c == '?') ? '_' : (char)std::tolower((unsigned char)c);
+            if (name.empty()) {
+                name = program_name(path);
+                if (banks > 1) name += "-" + std::to_string(b);
+                if (programs.size() > 1) name += "-" + std::to_string(k + 1);
+            }
+            std::string unique = name;
+            for (int n = 2; !used.insert(unique).second; n++) unique = name + "-" + std::to_string(n);
+
+            size_t stream = 0;
+            std::vector<uint8_t> program = decode_program(rom, bank, p.offset, stream);
+            std::string out = (dir.empty() || dir.back() == '/' ? dir : dir + "/") + unique + ".p";
+            write_file(out, program);
+            std::cout << "[info]   " << out << ": " << program.size() << " bytes (" << stream
+                      << " compressed at 0x" << std::hex << p.offset << std::dec << ")\n";
+            written++;
+        }
+    }
+    if (!written) throw std::runtime_error("no programs found in " + path);
+    std::cout << "OK → " << written << " program(s) from " << path << "\n";
+    return 0;
 }
 
-static uint8_t ascii_to_zx81(char c) {
-    // Numbers 0-9
-    if (c >= '0' && c <= '9') return c - 20;          // ASCII 48-57 → ZX81 0x1C-0x25
-    
-    // Letters A-Z  
-    if (c >= 'A' && c <= 'Z') return c - 27;          // ASCII 65-90 → ZX81 0x26-0x3F
-    
-    // Special characters
-    switch (c) {
-        case ' ':  return 0x00;  // ZX_SPACE
-        case '"':  return 0x0B;  // ZX_QUOTE
-        case '#':  return 0x0C;  // ZX_POUND
-        case '$':  return 0x0D;  // ZX_DOLLAR
-        case ':':  return 0x0E;  // ZX_COLON
-        case '?':  return 0x0F;  // ZX_QUERY
-        case '(':  return 0x10;  // ZX_BRACKET_LEFT
-        case ')':  return 0x11;  // ZX_BRACKET_RIGHT
-        case '>':  return 0x12;  // ZX_GREATER_THAN
-        case '<':  return 0x13;  // ZX_LESS_THAN
-        case '=':  return 0x14;  // ZX_EQUAL
-        case '+':  return 0x15;  // ZX_PLUS
-        case '-':  return 0x16;  // ZX_MINUS
-        case '*':  return 0x17;  // ZX_STAR
-        case '/':  return 0x18;  // ZX_SLASH
-        case ';':  return 0x19;  // ZX_SEMICOLON
-        case ',':  return 0x1A;  // ZX_COMMA
-        case '.':  return 0x1B;  // ZX_PERIOD
-        default:   return 0x00;  // Fallback to space for unknown chars
+// Adds, removes or replaces one program of a 16K image p2rom built (--update);
+// only the new program is compressed
+static int update_rom(const std::string& path, RomEdit edit, RomSpec spec, const EncoderOptions& options,
+                      const CompressionCache& cache, bool verify, std::ostream& log) {
+    MappedFile image(path), input, base;
+    if (edit.kind != RomEdit::Remove) {
+        input = MappedFile(edit.name);
+        edit.input = input.bytes();
     }
+    if (file_exists(spec.base_path.c_str())) base = MappedFile(spec.base_path);
+    if (spec.output.empty()) spec.output = path;
+
+    RomBuilder builder(options, 1);
+    builder.set_cache(&cache);
+    builder.set_log(&log);
+    builder.set_verify(verify);
+    const RomResult result = builder.update(image.bytes(), spec, edit, base.bytes());
+    replace_file(spec.output, result.image);
+
+    const BankReport& bank = result.report.banks[0];
+    log << "OK → " << spec.output << "\n"
+        << "  P-files: " << result.report.programs.size() << " files, " << bank.payload << " bytes total ("
+        << (edit.kind == RomEdit::Remove ? 0 : 1) << " compressed)\n"
+        << "  Upper-block: Used " << bank.used() << " / 8192 bytes  (free " << 8192 - bank.used() << ")\n"
+        << "  Decompression: dzx7_" << decoder_name(bank.decoder) << "\n";
+    return 0;
 }
 
 int main(int argc, char** argv) {
-    const char* base_path  = nullptr;
-    const char* loader_path = nullptr;
-    const char* out_path   = nullptr;
-	bool use_simple_menu = false;
-    bool force_loader = false;
+    RomSpec spec;
+    EncoderOptions encoder;
+    const char* manifest_path = nullptr;
+    const char* extract_path = nullptr;
+    const char* update_path = nullptr;
+    RomEdit update;
+    int update_ops = 0;
+    bool verify = false;
+    const char* stats_format = nullptr;
+    const char* trace_path = nullptr;
+    bool watch = false;
+    unsigned jobs = default_jobs();
+    const char* env_cache = std::getenv("P2ROM_CACHE_DIR");
+    const char* env_limit = std::getenv("P2ROM_CACHE_LIMIT");
+    std::string cache_dir = env_cache ? env_cache : "";
+    std::string cache_limit_text = env_limit ? env_limit : "64M";
+
+    enum { OPT_CACHE_LIMIT = 256, OPT_NO_CACHE, OPT_MATCH_FINDER, OPT_SPLIT, OPT_SPLIT_REPORT, OPT_SPEED, OPT_DECODER, OPT_VERIFY, OPT_STATS, OPT_TRACE, OPT_PROFILE, OPT_SYSVAR_DICT, OPT_COMPACT, OPT_WATCH, OPT_ADD, OPT_REMOVE, OPT_REPLACE };
+    static const option long_opts[] = {
+        {"manifest",    required_argument, nullptr, 'm'},
+        {"eprom",       required_argument, nullptr, 'e'},
+        {"select",      no_argument,       nullptr, 'k'},
+        {"cache-dir",   required_argument, nullptr, 'c'},
+        {"cache-limit", required_argument, nullptr, OPT_CACHE_LIMIT},
+        {"no-cache",    no_argument,       nullptr, OPT_NO_CACHE},
+        {"match-finder", required_argument, nullptr, OPT_MATCH_FINDER},
+        {"split",        optional_argument, nullptr, OPT_SPLIT},
+        {"split-report", no_argument,       nullptr, OPT_SPLIT_REPORT},
+        {"speed",        required_argument, nullptr, OPT_SPEED},
+        {"decoder",      required_argument, nullptr, OPT_DECODER},
+        {"verify",       no_argument,       nullptr, OPT_VERIFY},
+        {"stats",        optional_argument, nullptr, OPT_STATS},
+        {"trace",        required_argument, nullptr, OPT_TRACE},
+        {"profile-compressor", no_argument, nullptr, OPT_PROFILE},
+        {"sysvar-dict",  no_argument,       nullptr, OPT_SYSVAR_DICT},
+        {"compact",      no_argument,       nullptr, OPT_COMPACT},
+        {"watch",        no_argument,       nullptr, OPT_WATCH},
+        {"update",       required_argument, nullptr, 'u'},
+        {"add",          required_argument, nullptr, OPT_ADD},
+        {"remove",       required_argument, nullptr, OPT_REMOVE},
+        {"replace",      required_argument, nullptr, OPT_REPLACE},
+        {"extract",     required_argument, nullptr, 'x'},
+        {"help",        no_argument,       nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}
+    };
 	
     int opt;
-    while ((opt = getopt(argc, argv, "b:l:o:hsf")) != -1) {
+    while ((opt = getopt_long(argc, argv, "b:l:o:j:c:m:e:x:u:khsf012", long_opts, nullptr)) != -1) {
         switch (opt) {
-            case 'b': base_path  = optarg; break;
-            case 'l': loader_path = optarg; break;
-            case 'o': out_path   = optarg; break;
-            case 's': use_simple_menu = true; break;
-            case 'f': force_loader = true; break;
+            case 'b': spec.base_path  = optarg; break;
+            case 'l': spec.loader_path = optarg; break;
+            case 'o': spec.output   = optarg; break;
+            case 'x': extract_path = optarg; break;
+            case 'u': update_path = optarg; break;
+            case OPT_ADD:
+                update.kind = RomEdit::Add;
+                update.name = optarg;
+                update_ops++;
+                break;
+            case OPT_REMOVE:
+                update.kind = RomEdit::Remove;
+                update.entry = optarg;
+                update_ops++;
+                break;
+            case OPT_REPLACE: {
+                std::string arg = optarg;
+                auto eq = arg.find('=');
+                if (eq == std::string::npos || eq == 0 || eq + 1 == arg.size()) {
+                    std::cerr << "Error: --replace expects ENTRY=FILE, e.g. 2=game.p\n";
+                    return 1;
+                }
+                update.kind = RomEdit::Replace;
+                update.entry = arg.substr(0, eq);
+                update.name = arg.substr(eq + 1);
+                update_ops++;
+                break;
+            }
+            case 's': spec.simple_menu = true; break;
+            case 'f': spec.force_loader = true; break;
+            case 'j': {
+                int n = std::atoi(optarg);
+                if (n < 1) {
+                    std::cerr << "Error: -j expects a positive number of jobs\n";
+                    return 1;
+                }
+                jobs = (unsigned)n;
+                break;
+            }
+            case 'm': manifest_path = optarg; break;
+            case 'k': spec.select = true; break;
+            case '0': encoder.parse = ZX7_PARSE_GREEDY; break;
+            case '1': encoder.parse = ZX7_PARSE_LAZY; break;
+            case '2': encoder.parse = ZX7_PARSE_OPTIMAL; break;
+            case 'e':
+                if (!parse_eprom(optarg, spec.eprom_banks)) {
+                    std::cerr << "Error: unknown EPROM type '" << optarg << "' (try 27C256, 27C512 or a size like 64K)\n";
+                    return 1;
+                }
+                break;
+            case 'c': cache_dir = optarg; break;
+            case OPT_CACHE_LIMIT: cache_limit_text = optarg; break;
+            case OPT_NO_CACHE: cache_dir.clear(); break;
+            case OPT_MATCH_FINDER:
+                if (std::strcmp(optarg, "tree") == 0) encoder.match_finder = ZX7_MATCH_TREE;
+                else if (std::strcmp(optarg, "hash") == 0) encoder.match_finder = ZX7_MATCH_HASH;
+                else {
+                    std::cerr << "Error: unknown match finder '" << optarg << "' (tree or hash)\n";
+                    return 1;
+                }
+                break;
+            case OPT_SPLIT: {
+                uint64_t size = 4096;
+                if (optarg && (!parse_size(optarg, size) || size == 0)) {
+                    std::cerr << "Error: invalid segment size '" << optarg << "'\n";
+                    return 1;
+                }
+                encoder.split = (size_t)size;
+                break;
+            }
+            case OPT_SPLIT_REPORT: encoder.split_report = true; break;
+            case OPT_VERIFY: verify = true; break;
+            case OPT_STATS:
+                stats_format = optarg ? optarg : "text";
+                if (std::strcmp(stats_format, "text") != 0 && std::strcmp(stats_format, "json") != 0) {
+                    std::cerr << "Error: unknown stats format '" << optarg << "' (text or json)\n";
+                    return 1;
+                }
+                break;
+            case OPT_TRACE: trace_path = optarg; break;
+            case OPT_PROFILE: encoder.profile = true; break;
+            case OPT_SYSVAR_DICT: encoder.sysvar_dict = spec.sysvar_dict = true; break;
+            case OPT_COMPACT: encoder.compact = true; break;
+            case OPT_WATCH: watch = true; break;
+            case OPT_DECODER:
+                if (!parse_decoder(optarg, spec.decoder)) {
+                    std::cerr << "Error: unknown decoder '" << optarg << "' (auto, standard, turbo or mega)\n";
+                    return 1;
+                }
+                break;
+            case OPT_SPEED: {
+                char* end = nullptr;
+                double lambda = std::strtod(optarg, &end);
+                if (end == optarg || *end || !(lambda >= 0 && lambda <= 100)) {
+                    std::cerr << "Error: invalid speed weight '" << optarg << "' (bits per T-state, 0 to 100)\n";
+                    return 1;
+                }
+                encoder.speed = (uint32_t)std::lround(lambda * ZX7_SPEED_ONE);
+                break;
+            }
             case 'h':
             default:
                 std::cerr <<
                   "Usage: " << argv[0] << " [-b base8k.rom] [-l loader.bin] [-o out.rom] <program1.p> [program2.p] [...]\n"
+                  "       " << argv[0] << " -m manifest.txt\n"
+                  "       " << argv[0] << " -x image.rom [-o dir]\n"
+                  "       " << argv[0] << " -u image.rom [-o out.rom] --add FILE | --remove ENTRY | --replace ENTRY=FILE\n"
                   "  -b  Optional base ROM (8K)\n"
                   "  -l  Optional loader (ignored when multiple P-files, uses menu loader)\n"
                   "  -o  Optional output name\n"
                   "  -s  Optional use very simple menu for multiple files\n"
                   "  -f  Optional force a custom loader with multiple files (warning: you should know what you are doing)\n"
+                  "  -j  Optional number of files to compress in parallel (default: number of cores)\n"
+                  "  -0, -1, -2            Compression level: greedy, lazy or optimal (default); the fast\n"
+                  "                        levels take a fraction of the time for slightly larger files\n"
+                  "  -e, --eprom TYPE      Spread the P-files over the 16K banks of an EPROM (e.g. 27C512, 64K)\n"
+                  "                        and write a bank map next to the image\n"
+                  "  -k, --select          Build the highest priority set of P-files that fits and report\n"
+                  "                        the rest; inputs may be given as file.p:priority (default 1)\n"
+                  "  -m, --manifest FILE   Build every ROM listed in FILE in one run\n"
+                  "  -x, --extract IMAGE   Decode the programs of a ROM or EPROM image built by p2rom back\n"
+                  "                        to .p files, in the -o directory (default: current)\n"
+                  "      --watch           Keep running and rebuild whenever an input, base ROM, loader or\n"
+                  "                        manifest changes; only changed programs are compressed again\n"
+                  "  -u, --update IMAGE    Change one program of a 16K image built by p2rom, compressing only\n"
+                  "                        that program; written back to IMAGE unless -o is given\n"
+                  "      --add FILE        With -u: add FILE as the last menu entry\n"
+                  "      --remove ENTRY    With -u: remove a program, by menu number or name\n"
+                  "      --replace ENTRY=FILE  With -u: replace a program, by menu number or name, with FILE\n"
+                  "      --verify          Decode every payload from the finished image and compare it with\n"
+                  "                        its input before writing\n"
+                  "      --stats[=FORMAT]  Time every stage and report it: text (default) after the log, or\n"
+                  "                        json on stdout, with sizes and patch locations (the log moves to stderr)\n"
+                  "      --trace FILE      Write the stages per thread as a Chrome trace (chrome://tracing)\n"
+                  "      --profile-compressor  Report the compressor's match finder counters and the token\n"
+                  "                        mix of each parse (needs a build with make PROFILE=1)\n"
+                  "  -c, --cache-dir DIR   Optional compression cache directory (default: $P2ROM_CACHE_DIR)\n"
+                  "      --cache-limit N   Optional cache size limit, e.g. 512K, 64M (default: $P2ROM_CACHE_LIMIT or 64M)\n"
+                  "      --no-cache        Ignore the cache directory from the environment\n"
+                  "      --match-finder F  Compressor match finder, hash (default) or tree; same output\n"
+                  "      --split[=SIZE]    Parse P-files larger than SIZE (default 4K) in segments of SIZE\n"
+                  "                        on separate cores; output grows slightly\n"
+                  "      --split-report    With --split, also compress each split P-file in one piece and\n"
+                  "                        report the difference\n"
+                  "      --speed LAMBDA    Optimal parse: trade LAMBDA bits for each T-state saved in the\n"
+                  "                        loader's dzx7 (e.g. 0.05; default 0, smallest output)\n"
+                  "      --decoder D       ZX7 decoder in the loader: standard (69 bytes), turbo (88), mega\n"
+                  "                        (118), or auto (default): the fastest that leaves room\n"
+                  "      --sysvar-dict     Compress each P-file against a canonical system variable block\n"
+                  "                        that the loader puts in RAM first (about 85 bytes per image; pays\n"
+                  "                        off on menus with several small programs)\n"
+                  "      --compact         Drop anything after each P-file's E_LINE, where LOAD stops\n"
                   "  Multiple P-files will create a menu-driven ROM\n";
                 return (opt=='h') ? 0 : 1;
         }
     }
     
-    if (optind >= argc) {
-        std::cerr << "Error: no P-file(s) specified\n";
+    if (encoder.split_report && !encoder.split) encoder.split = 4096;
+    if (encoder.profile && !zx7_profiling()) {
+        std::cerr << "Error: --profile-compressor needs the compressor counters; rebuild with make clean && make PROFILE=1\n";
         return 1;
     }
-
-    // Collect all P-file paths
-    std::vector<std::string> p_paths;
-    for (int i = optind; i < argc; i++) {
-        p_paths.push_back(argv[i]);
+    if (encoder.speed && encoder.parse != ZX7_PARSE_OPTIMAL) {
+        std::cerr << "Error: --speed weights the optimal parse and can't be combined with -0 or -1\n";
+        return 1;
     }
 
-    std::string out_file = out_path ? std::string(out_path) : derive_output_name(p_paths);
+    uint64_t cache_limit = 0;
+    if (!parse_size(cache_limit_text, cache_limit)) {
+        std::cerr << "Error: invalid cache limit '" << cache_limit_text << "'\n";
+        return 1;
+    }
 
-    try {
-        // Base ROM
-        std::vector<uint8_t> base = file_exists(base_path) ? slurp(base_path) : load_embedded_base();
-        if (base.size() != 8192) throw std::runtime_error("Base ROM must be exactly 8K");
-
-        // Choose loader based on number of P-files
-        std::vector<uint8_t> stub;
-        bool use_menu = (p_paths.size() > 1);
-        
-        if (use_menu) {
-            if(!force_loader)
-            {
-                stub = load_embedded_menuloader();
-                std::cout << "[info] Using menu loader for " << p_paths.size() << " P-files\n";
-            } else {
-                stub =  slurp(loader_path);
-                std::cout << "[note] Using custom menu loader for " << p_paths.size() << " P-files\n";
-            }
-        } else {
-            stub = file_exists(loader_path) ? slurp(loader_path) : load_embedded_loader();
-            std::cout << "[info] Using single-file loader\n";
+    if (extract_path) {
+        if (manifest_path || optind < argc || watch || update_path) {
+            std::cerr << "Error: --extract takes only the image to read\n";
+            return 1;
         }
-        
-        if (stub.size() > 8192) throw std::runtime_error("Loader too large for upper 8K");
-
-        // Process all P-files
-        std::vector<CompressedPFile> compressed_files;
-        size_t total_compressed_size = 0;
-
-        for (const auto& p_path : p_paths) {
-            CompressedPFile pfile;
-            pfile.original_name = basename_no_ext(p_path);
-            
-            auto payload_raw = slurp(p_path);
-            bool already_zx7 = is_zx7(p_path);
-            
-            if (already_zx7) {
-                pfile.compressed_data = std::move(payload_raw);
-                std::cout << "[info] " << pfile.original_name << " is already ZX7-compressed (" 
-                         << pfile.compressed_data.size() << " bytes)\n";
-            } else {
-                std::cout << "[info] Compressing " << pfile.original_name << " with ZX7... ";
-                pfile.compressed_data = zx7_encode(payload_raw);
-                std::cout << "done (" << pfile.compressed_data.size() << " bytes, from " 
-                         << payload_raw.size() << " raw)\n";
-            }
-            
-            total_compressed_size += pfile.compressed_data.size();
-            compressed_files.push_back(std::move(pfile));
+        try {
+            return extract_rom(extract_path, spec.output.empty() ? "." : spec.output);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 2;
         }
+    }
 
-        // Check if everything fits (including filename block)
-        size_t filename_block_size = 0;
-        if (use_menu && compressed_files.size() > 1) {
-            for (const auto& pfile : compressed_files) {
-                std::string filename_entry = std::to_string(&pfile - &compressed_files[0] + 1) + ") " + pfile.original_name;
-                filename_block_size += filename_entry.length();
-            }
+    if (update_path || update_ops) {
+        if (!update_path || update_ops != 1 || manifest_path || optind < argc || watch) {
+            std::cerr << "Error: --update takes the image and one of --add, --remove or --replace\n";
+            return 1;
         }
-        
-        size_t available_space = 8192 - stub.size();
-        size_t total_needed = filename_block_size + total_compressed_size;
-        
-        if (total_needed > available_space) {
-            throw std::runtime_error("Filename block (" + std::to_string(filename_block_size) + 
-                                   " bytes) + compressed P-files (" + std::to_string(total_compressed_size) + 
-                                   " bytes) don't fit in available space (" + std::to_string(available_space) + " bytes)");
+        try {
+            CompressionCache cache(cache_dir, cache_limit);
+            return update_rom(update_path, update, spec, encoder, cache, verify, std::cout);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 2;
         }
+    }
 
-        // Build 16K ROM
-        std::vector<uint8_t> rom(16384, 0x00);
-
-        // Lower 8K: base ROM
-        std::copy(base.begin(), base.end(), rom.begin());
-
-        // Upper 8K: loader + filenames + P-files
-        const size_t loader_off = 0x2000;
-        size_t cursor = loader_off;
-        
-        // Copy loader
-        std::copy(stub.begin(), stub.end(), rom.begin() + cursor);
-        cursor += stub.size();
-
-        // Add filename block (only for multi-file mode)
-        size_t filename_block_start = cursor;
-        if (use_menu && compressed_files.size() > 1) {
-            
-
-        	if(use_simple_menu){
-        		 std::cout << "[info] Writing simple menu\n";	
-        		 rom[cursor++] =  ascii_to_zx81( std::to_string(compressed_files.size())[0] );
-        		 rom[cursor++] = 0x09;            
-        	} 
-        	else 
-        	{
-	        	rom[cursor++] =  ascii_to_zx81( std::to_string(compressed_files.size())[0] );
-	        	rom[cursor++] = 0x76;
-	            std::cout << "[info] Writing filename block at offset 0x" << std::hex << cursor << std::dec << "\n";
-            
-	            for (size_t i = 0; i < compressed_files.size(); i++) {
-           	     std::string filename_entry = std::to_string(i + 1) + ") " + compressed_files[i].original_name;
-                
-            	    // Uppercase
-//					std::transform(filename_entry.begin(), filename_entry.end(), filename_entry.begin(), [](unsigned char c) { return std::toupper(c); });
-
-        	        rom[cursor++] = 0x76;	//Start by adding a new line
-    	            // Write each character as a byte
-	                for (char c : filename_entry) {
-        	            if (cursor >= rom.size()) {
-    	                    throw std::runtime_error("Filename block exceeds ROM size");
-	                    }
-                    
-            	        c = std::toupper(static_cast<unsigned char>(c));
-					    rom[cursor++] = ascii_to_zx81(c);
-    	            }
-	                rom[cursor++] = 0x76;	//New line
-                	std::cout << "[info]   Entry " << (i + 1) << ": \"" << filename_entry << "\" (" << filename_entry.length() << " bytes)\n";
-            	}
-
-                //Write BASIC option to end of list
-                std::string basic_entry = "B) BASIC";
-                rom[cursor++] = 0x76;
-                for (char c : basic_entry) {
-                    if (cursor >= rom.size()) {
-                        throw std::runtime_error("Filename block exceeds ROM size");
-                    }
-                
-                    c = std::toupper(static_cast<unsigned char>(c));
-                    rom[cursor++] = ascii_to_zx81(c);
-                }
-                
-                
-                rom[cursor++] = 0x09; // Add String terminator
-    	        size_t filename_block_size = cursor - filename_block_start;
-	            std::cout << "[info] Filename block: " << filename_block_size << " bytes total\n";
+    if (!manifest_path && optind >= argc) {
+        std::cerr << "Error: no P-file(s) specified\n";
+        return 1;
+    }
+    if (manifest_path && optind < argc) {
+        std::cerr << "Error: P-files are listed in the manifest, not on the command line\n";
+        return 1;
+    }
+
+    // Collect all P-file paths
+    for (int i = optind; i < argc; i++) {
+        std::string path = argv[i];
+        uint64_t priority = 1;
+        // In select mode "file.p:5" gives file.p priority 5 (unless such a file exists)
+        auto colon = path.find_last_of(':');
+        if (spec.select && colon != std::string::npos && !file_exists(path.c_str())) {
+            std::string digits = path.substr(colon + 1);
+            if (digits.empty() || digits.find_first_not_of("0123456789") != std::string::npos
+                || std::strtoull(digits.c_str(), nullptr, 10) == 0) {
+                std::cerr << "Error: invalid priority in '" << path << "'\n";
+                return 1;
             }
+            priority = std::strtoull(digits.c_str(), nullptr, 10);
+            path.resize(colon);
         }
+        spec.inputs.push_back(path);
+        spec.priorities.push_back(priority);
+    }
+    if (spec.select && spec.eprom_banks) {
+        std::cerr << "Error: --select builds a single 16K image and can't be combined with --eprom\n";
+        return 1;
+    }
 
-        // Store P-files and track their offsets
-        for (auto& pfile : compressed_files) {
-            pfile.offset = cursor;
-            std::copy(pfile.compressed_data.begin(), pfile.compressed_data.end(), rom.begin() + cursor);
-            cursor += pfile.compressed_data.size();
-            
-            std::cout << "[info] " << pfile.original_name << " stored at offset 0x" 
-                     << std::hex << pfile.offset << std::dec << "\n";
-        }
+    if (spec.output.empty() && !manifest_path) spec.output = derive_output_name(spec.inputs);
 
-        // Patch menu loader with actual P-file offsets (only for multi-file mode)
-        if (use_menu && compressed_files.size() > 1) {
-            std::cout << "[info] Patching menu loader with P-file offsets...\n";
-            if(force_loader)
-                std::cout << "[warning] Custom loader forced. This might end bad...\n";
-            
-            size_t search_start = loader_off;
-            size_t search_end = loader_off + stub.size();
-            size_t patches_made = 0;
-            
-            for (size_t i = search_start; i <= search_end - 3 && patches_made < compressed_files.size(); i++) {
-                // Look for pattern: 21 00 20 (LD HL, $2000)
-                if (rom[i] == 0x21 && rom[i+1] == 0x00 && rom[i+2] == 0x20) {
-                    uint16_t offset = static_cast<uint16_t>(compressed_files[patches_made].offset);
-                    uint8_t low_byte = offset & 0xFF;
-                    uint8_t high_byte = (offset >> 8) & 0xFF;
-                    
-                    rom[i+1] = low_byte;
-                    rom[i+2] = high_byte;
-                    
-                    std::cout << "[info]   Patch " << patches_made << ": 0x" << std::hex << (i - loader_off) 
-                             << " -> LD HL,$" << std::hex << offset << std::dec 
-                             << " (" << compressed_files[patches_made].original_name << ")\n";
-                    
-                    patches_made++;
-                }
-            }
-            
-            if (patches_made != compressed_files.size()) {
-                std::cout << "[warning] Expected " << compressed_files.size() 
-                         << " patches but made " << patches_made << "\n";
-            }
-        }
+    // With JSON statistics stdout carries only the JSON document
+    const bool json = stats_format && std::strcmp(stats_format, "json") == 0;
+    std::ostream& log = json ? std::cerr : std::cout;
 
-        // Write ROM
-        std::ofstream out(out_file, std::ios::binary);
-        out.write(reinterpret_cast<const char*>(rom.data()), (std::streamsize)rom.size());
-        if (!out) throw std::runtime_error("Could not write output");
-
-        // Summary
-        size_t used_upper = stub.size() + filename_block_size + total_compressed_size;
-        size_t free_upper = 8192 - used_upper;
-        
-        std::cout << "OK → " << out_file << "\n"
-                 << "  Base:  " << (base_path ? base_path : "[embedded]") << "  (" << base.size() << " bytes)\n"
-                 << "  Loader: " << (use_menu ? "[embedded menu]" : (loader_path ? loader_path : "[embedded single]")) 
-                 << " (" << stub.size() << " bytes)\n";
-        
-        if (use_menu && filename_block_size > 0) {
-            std::cout << "  Filenames: " << filename_block_size << " bytes\n";
-        }
-        
-        std::cout << "  P-files: " << compressed_files.size() << " files, " << total_compressed_size << " bytes total\n"
-                 << "  Upper-block: Used " << used_upper << " / 8192 bytes  (free " << free_upper << ")\n";
-
-        if (use_menu) {
-            std::cout << "\nP-file offsets for menu loader:\n";
-            for (const auto& pfile : compressed_files) {
-                std::cout << "  " << pfile.original_name << ": 0x" << std::hex << pfile.offset << std::dec << "\n";
+    try {
+        CompressionCache cache(cache_dir, cache_limit);
+        if (watch) cache.keep_in_memory();
+
+        // One build, with statistics of its own; watcher (with --watch) is
+        // told every file it reads
+        auto build = [&](FileWatcher* watcher) {
+            BuildStats stats;
+            if (stats_format || trace_path) stats.enable();
+            int status;
+            if (manifest_path) {
+                if (watcher) watcher->add(manifest_path);
+                std::vector<RomSpec> roms = read_manifest(manifest_path);
+                for (auto& rom : roms) {
+                    rom.sysvar_dict = encoder.sysvar_dict;
+                    if (watcher) watch_spec(rom, *watcher);
+                }
+                status = build_batch(roms, encoder, jobs, cache, verify, !watcher, stats, log);
+            } else {
+                if (watcher) watch_spec(spec, *watcher);
+                status = build_single(spec, encoder, jobs, cache, verify, !watcher, stats, log);
             }
-        }
-
-        return 0;
+            if (json) stats.write_json(std::cout);
+            else if (stats_format) stats.write_text(log);
+            if (trace_path) stats.write_trace(trace_path);
+            return status;
+        };
+        if (watch) return watch_builds([&](FileWatcher& watcher) { return build(&watcher); }, log);
+        return build(nullptr);
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << "\n";
         return 2;
@@ -0,0 +1,128 @@
+// bytes.cpp - byte ranges without copies: views of buffers, and files mapped into memory
+#include "bytes.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// Closes a descriptor when it goes out of scope
+struct Fd {
+    int fd;
+    explicit Fd(int fd) : fd(fd) {}
+    ~Fd() { if (fd >= 0) ::close(fd); }
+};
+
+// Everything left to read from fd, in chunks of at least hint bytes
+std::vector<uint8_t> read_all(int fd, size_t hint) {
+    std::vector<uint8_t> data(std::max<size_t>(hint, 4096));
+    size_t used = 0;
+    for (;;) {
+        if (used == data.size()) data.resize(data.size() * 2);
+        ssize_t n = ::read(fd, data.data() + used, data.size() - used);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) throw std::runtime_error("read failed");
+        if (n == 0) break;
+        used += (size_t)n;
+    }
+    data.resize(used);
+    return data;
+}
+
+} // namespace
+
+bool operator==(ByteView a, ByteView b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin());
+}
+
+MappedFile::MappedFile(const std::string& path, bool map) {
+    Fd f(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    struct stat st{};
+    if (f.fd < 0 || ::fstat(f.fd, &st) != 0) throw std::runtime_error("Cannot open: " + path);
+    if (map && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* mapped = ::mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, f.fd, 0);
+        if (mapped != MAP_FAILED) {
+            map_ = mapped;
+            size_ = (size_t)st.st_size;
+            return;
+        }
+    }
+    try {
+        read_ = read_all(f.fd, S_ISREG(st.st_mode) ? (size_t)st.st_size : 0);
+    } catch (const std::exception&) {
+        throw std::runtime_error("Cannot read: " + path);
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (map_) ::munmap(map_, size_);
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : map_(other.map_), size_(other.size_), read_(std::move(other.read_)) {
+    other.map_ = nullptr;
+    other.size_ = 0;
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+        if (map_) ::munmap(map_, size_);
+        map_ = other.map_;
+        size_ = other.size_;
+        read_ = std::move(other.read_);
+        other.map_ = nullptr;
+        other.size_ = 0;
+    }
+    return *this;
+}
+
+std::vector<uint8_t> read_file(const std::string& path) {
+    Fd f(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    struct stat st{};
+    if (f.fd < 0 || ::fstat(f.fd, &st) != 0) throw std::runtime_error("Cannot open: " + path);
+    try {
+        return read_all(f.fd, S_ISREG(st.st_mode) ? (size_t)st.st_size + 1 : 0);
+    } catch (const std::exception&) {
+        throw std::runtime_error("Cannot read: " + path);
+    }
+}
+
+void write_file(const std::string& path, ByteView data) {
+    Fd f(::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666));
+    if (f.fd < 0) throw std::runtime_error("Could not write " + path);
+    const uint8_t* p = data.data();
+    size_t left = data.size();
+    while (left) {
+        ssize_t n = ::write(f.fd, p, left);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) throw std::runtime_error("Could not write " + path);
+        p += n;
+        left -= (size_t)n;
+    }
+    if (::close(f.fd) != 0) {
+        f.fd = -1;
+        throw std::runtime_error("Could not write " + path);
+    }
+    f.fd = -1;
+}
+
+void replace_file(const std::string& path, ByteView data) {
+    std::string tmp = path + ".tmp." + std::to_string(getpid());
+    try {
+        write_file(tmp, data);
+    } catch (const std::exception&) {
+        std::remove(tmp.c_str());
+        throw std::runtime_error("Could not write " + path);
+    }
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        throw std::runtime_error("Could not write " + path);
+    }
+}
@@ -0,0 +1,66 @@
+// bytes.h - byte ranges without copies: views of buffers, and files mapped into memory
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Read-only view of bytes owned elsewhere, such as a vector, an embedded
+// array or a mapped file; valid as long as its owner
+class ByteView {
+public:
+    ByteView() = default;
+    ByteView(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+    ByteView(const std::vector<uint8_t>& bytes) : data_(bytes.data()), size_(bytes.size()) {}
+
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const uint8_t* begin() const { return data_; }
+    const uint8_t* end() const { return data_ + size_; }
+    uint8_t operator[](size_t i) const { return data_[i]; }
+
+    std::vector<uint8_t> to_vector() const { return std::vector<uint8_t>(begin(), end()); }
+
+private:
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+bool operator==(ByteView a, ByteView b);
+inline bool operator!=(ByteView a, ByteView b) { return !(a == b); }
+
+// A whole file, mapped read-only; files that can't be mapped, such as pipes,
+// are read into memory instead. map = false always reads, for files another
+// program may truncate while they are in use: touching a mapped page past the
+// new end raises SIGBUS. Throws std::runtime_error if it can't be read.
+class MappedFile {
+public:
+    MappedFile() = default;
+    explicit MappedFile(const std::string& path, bool map = true);
+    ~MappedFile();
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ByteView bytes() const { return map_ ? ByteView(static_cast<const uint8_t*>(map_), size_) : ByteView(read_); }
+
+private:
+    void* map_ = nullptr;
+    size_t size_ = 0;
+    std::vector<uint8_t> read_;
+};
+
+// Reads a whole file into a vector sized for it up front
+std::vector<uint8_t> read_file(const std::string& path);
+
+// Creates or replaces path with data, handed to the kernel in one write()
+// (repeated only if it comes back short); throws std::runtime_error on failure
+void write_file(const std::string& path, ByteView data);
+
+// Writes data to a temporary file next to path and renames it over path, so
+// a reader (an emulator reloading the ROM) sees the old file or the new one,
+// never a partial write
+void replace_file(const std::string& path, ByteView data);
@@ -0,0 +1,187 @@
+// cache.cpp - persistent, content-addressed store of ZX7 compressed streams
+#include "cache.h"
+#include "sha256.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+#include <functional>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+extern "C" {
+    #include "zx7/zx7.h"
+}
+
+namespace {
+
+const char* const CACHE_SUFFIX = ".zx7";
+
+// Every entry starts with a header that lets lookup() reject truncated or
+// corrupted files, and entries written by older versions without it
+const char ENTRY_MAGIC[4] = { 'P', '2', 'R', 'C' };
+const size_t ENTRY_HEADER = 4 + 4 + 32;  // magic, raw size (little-endian), SHA-256 of the stream
+
+std::vector<uint8_t> entry_header(size_t raw_size, const std::vector<uint8_t>& data) {
+    std::vector<uint8_t> header(ENTRY_MAGIC, ENTRY_MAGIC + 4);
+    for (int i = 0; i < 4; i++) header.push_back((uint8_t)(raw_size >> (8 * i)));
+    Sha256 h;
+    h.update(data.data(), data.size());
+    Sha256::Digest digest = h.finish();
+    header.insert(header.end(), digest.begin(), digest.end());
+    return header;
+}
+
+// mkdir -p
+void make_dirs(const std::string& dir) {
+    for (size_t pos = 1; pos <= dir.size(); pos++) {
+        if (pos == dir.size() || dir[pos] == '/') {
+            std::string part = dir.substr(0, pos);
+            if (mkdir(part.c_str(), 0777) != 0 && errno != EEXIST) {
+                throw std::runtime_error("Cannot create cache directory: " + part);
+            }
+        }
+    }
+}
+
+} // namespace
+
+CompressionCache::CompressionCache(std::string dir, uint64_t limit)
+    : dir_(std::move(dir)), limit_(limit) {
+    while (dir_.size() > 1 && dir_.back() == '/') dir_.pop_back();
+    if (enabled()) make_dirs(dir_);
+}
+
+std::string CompressionCache::key(ByteView raw, const std::string& settings) {
+    Sha256 h;
+    h.update(std::string("p2rom-cache\n") + ZX7_ENCODER_VERSION + "\n" + settings + "\n");
+    h.update(raw.data(), raw.size());
+    return Sha256::hex(h.finish());
+}
+
+std::string CompressionCache::path_for(const std::string& key) const {
+    return dir_ + "/" + key + CACHE_SUFFIX;
+}
+
+bool CompressionCache::lookup(const std::string& key, size_t raw_size, std::vector<uint8_t>& out) const {
+    if (!enabled()) return false;
+
+    if (memory_) {
+        std::lock_guard<std::mutex> lock(memory_mutex_);
+        auto it = memory_entries_.find(key);
+        if (it != memory_entries_.end()) {
+            out = it->second;
+            return true;
+        }
+    }
+    if (dir_.empty()) return false;
+
+    std::string path = path_for(key);
+    std::vector<uint8_t> data;
+    try {
+        data = read_file(path);
+    } catch (const std::exception&) {
+        return false;
+    }
+    if (data.empty()) return false;
+
+    std::vector<uint8_t> stream;
+    if (data.size() > ENTRY_HEADER) stream.assign(data.begin() + ENTRY_HEADER, data.end());
+    if (stream.empty() || !std::equal(data.begin(), data.begin() + ENTRY_HEADER, entry_header(raw_size, stream).begin())) {
+        std::remove(path.c_str());
+        return false;
+    }
+
+    utimes(path.c_str(), nullptr);  // mark as recently used for trim()
+    out = std::move(stream);
+    remember(key, out);
+    return true;
+}
+
+void CompressionCache::remember(const std::string& key, const std::vector<uint8_t>& data) const {
+    if (!memory_) return;
+    std::lock_guard<std::mutex> lock(memory_mutex_);
+    if (memory_bytes_ + data.size() > limit_) {
+        memory_entries_.clear();
+        memory_bytes_ = 0;
+    }
+    if (memory_entries_.emplace(key, data).second) memory_bytes_ += data.size();
+}
+
+void CompressionCache::store(const std::string& key, size_t raw_size, const std::vector<uint8_t>& data) const {
+    remember(key, data);
+    if (dir_.empty()) return;
+
+    // Write to a private temp name and rename, so concurrent builds never see
+    // a partial entry
+    std::string path = path_for(key);
+    std::string tmp = path + ".tmp." + std::to_string(getpid()) + "."
+                    + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    {
+        std::vector<uint8_t> header = entry_header(raw_size, data);
+        std::ofstream f(tmp, std::ios::binary);
+        f.write(reinterpret_cast<const char*>(header.data()), (std::streamsize)header.size());
+        f.write(reinterpret_cast<const char*>(data.data()), (std::streamsize)data.size());
+        if (!f) {
+            std::remove(tmp.c_str());
+            return;  // a cache that can't be written is not an error
+        }
+    }
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) std::remove(tmp.c_str());
+}
+
+void CompressionCache::trim() const {
+    if (dir_.empty()) return;
+
+    struct Entry { std::string path; uint64_t size; time_t used; };
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+
+    DIR* d = opendir(dir_.c_str());
+    if (!d) return;
+    while (dirent* e = readdir(d)) {
+        std::string name = e->d_name;
+        if (name.size() <= 4 || name.compare(name.size() - 4, 4, CACHE_SUFFIX) != 0) continue;
+        std::string path = dir_ + "/" + name;
+        struct stat st{};
+        if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        entries.push_back({path, (uint64_t)st.st_size, st.st_mtime});
+        total += (uint64_t)st.st_size;
+    }
+    closedir(d);
+
+    if (total <= limit_) return;
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry& a, const Entry& b) { return a.used < b.used; });
+    for (const auto& e : entries) {
+        if (total <= limit_) break;
+        if (std::remove(e.path.c_str()) == 0) total -= e.size;
+    }
+}
+
+bool parse_size(const std::string& text, uint64_t& bytes) {
+    // strtoull would take "-1" and wrap it to a huge size
+    if (text.find('-') != std::string::npos) return false;
+    char* end = nullptr;
+    errno = 0;
+    unsigned long long n = std::strtoull(text.c_str(), &end, 10);
+    if (errno || end == text.c_str()) return false;
+
+    std::string unit(end);
+    uint64_t scale = 1;
+    if (unit == "K" || unit == "k") scale = 1ull << 10;
+    else if (unit == "M" || unit == "m") scale = 1ull << 20;
+    else if (unit == "G" || unit == "g") scale = 1ull << 30;
+    else if (!unit.empty()) return false;
+
+    if (n > UINT64_MAX / scale) return false;  // the product would wrap
+    bytes = (uint64_t)n * scale;
+    return true;
+}
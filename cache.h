@@ -0,0 +1,53 @@
+// cache.h - persistent, content-addressed store of ZX7 compressed streams
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "bytes.h"
+
+class CompressionCache {
+public:
+    // An empty dir disables the cache; limit is the total size in bytes kept on disk
+    CompressionCache(std::string dir, uint64_t limit);
+
+    bool enabled() const { return !dir_.empty() || memory_; }
+    const std::string& dir() const { return dir_; }
+
+    // Also keeps entries in memory, in front of the directory if there is one,
+    // for processes that build the same inputs over and over (--watch). The
+    // memory copy is dropped whole when it outgrows the limit.
+    void keep_in_memory() { memory_ = true; }
+
+    // Key over the raw input plus everything that influences the encoder output
+    // (the match finder does not, so both finders share entries)
+    static std::string key(ByteView raw, const std::string& settings);
+
+    // Safe to call from several threads at once for different or equal keys.
+    // raw_size is the length of the input the stream was compressed from; an
+    // entry whose stream fails its checksum or was stored for another length
+    // is deleted and reported as a miss.
+    bool lookup(const std::string& key, size_t raw_size, std::vector<uint8_t>& out) const;
+    void store(const std::string& key, size_t raw_size, const std::vector<uint8_t>& data) const;
+
+    // Removes least recently used entries until the cache fits its limit
+    void trim() const;
+
+private:
+    std::string path_for(const std::string& key) const;
+    void remember(const std::string& key, const std::vector<uint8_t>& data) const;
+
+    std::string dir_;
+    uint64_t limit_;
+    bool memory_ = false;
+    mutable std::mutex memory_mutex_;
+    mutable std::map<std::string, std::vector<uint8_t>> memory_entries_;
+    mutable uint64_t memory_bytes_ = 0;
+};
+
+// Parses sizes such as "512K", "64M" or "1G" (plain numbers are bytes)
+bool parse_size(const std::string& text, uint64_t& bytes);
@@ -0,0 +1,98 @@
+// dzx7.cpp - host-side ZX7 decoder, for checking and extracting ROM payloads
+#include "dzx7.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+// Reads the stream the way dzx7_standard does: bytes in order, with a bit
+// buffer refilled from the next byte whenever it runs empty
+struct Reader {
+    const uint8_t* data;
+    size_t size;
+    size_t pos = 0;
+    unsigned bits = 0;
+    unsigned mask = 0;
+
+    uint8_t byte() {
+        if (pos >= size) throw std::runtime_error("ZX7 stream runs past its end");
+        return data[pos++];
+    }
+
+    unsigned bit() {
+        if (!mask) {
+            bits = byte();
+            mask = 0x80;
+        }
+        unsigned b = (bits & mask) != 0;
+        mask >>= 1;
+        return b;
+    }
+};
+
+} // namespace
+
+std::vector<uint8_t> dzx7_decode(const uint8_t* data, size_t size, size_t max_output, size_t* consumed,
+                                 const std::vector<uint8_t>& dictionary) {
+    Reader in{data, size};
+    const size_t start = dictionary.size();
+    std::vector<uint8_t> out(start + max_output);
+    std::copy(dictionary.begin(), dictionary.end(), out.begin());
+    uint8_t* dst = out.data();
+    size_t n = start;
+    max_output += start;
+
+    auto overflow = [&]() {
+        throw std::runtime_error("ZX7 stream decodes to more than " + std::to_string(max_output - start) + " bytes");
+    };
+
+    if (max_output == start) overflow();
+    dst[n++] = in.byte();
+    for (;;) {
+        if (!in.bit()) {
+            if (n == max_output) overflow();
+            dst[n++] = in.byte();
+            continue;
+        }
+
+        // Elias gamma of len-1; 16 leading zeros is the end marker
+        int zeros = 0;
+        while (!in.bit()) {
+            if (++zeros == 16) {
+                in.bit();
+                out.resize(n);
+                out.erase(out.begin(), out.begin() + start);
+                if (consumed) *consumed = in.pos;
+                return out;
+            }
+        }
+        size_t len = 1;
+        for (int i = 0; i < zeros; i++) len = len << 1 | in.bit();
+        len++;
+
+        size_t offset = in.byte();
+        if (offset & 0x80) {
+            unsigned high = in.bit() << 3;
+            high |= in.bit() << 2;
+            high |= in.bit() << 1;
+            high |= in.bit();
+            offset = ((offset & 0x7F) | high << 7) + 128;
+        }
+        offset++;
+
+        if (offset > n) {
+            throw std::runtime_error("ZX7 match at byte " + std::to_string(n - start) + " reaches back "
+                                     + std::to_string(offset) + " bytes");
+        }
+        if (len > max_output - n) overflow();
+        if (offset >= len) {
+            std::memcpy(dst + n, dst + n - offset, len);
+        } else {
+            for (size_t i = 0; i < len; i++) dst[n + i] = dst[n + i - offset];
+        }
+        n += len;
+    }
+}
@@ -0,0 +1,15 @@
+// dzx7.h - host-side ZX7 decoder, for checking and extracting ROM payloads
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Decodes the ZX7 stream at data, reading at most size bytes, and returns the
+// output. Throws std::runtime_error if the stream runs past size, a match
+// reaches back before the start of the output, or the output would grow past
+// max_output. When consumed is given it receives the length of the stream.
+// Matches may also reach into dictionary, the bytes taken to precede the
+// output, which is not part of what is returned.
+std::vector<uint8_t> dzx7_decode(const uint8_t* data, size_t size, size_t max_output,
+                                 size_t* consumed = nullptr, const std::vector<uint8_t>& dictionary = {});
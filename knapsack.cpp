@@ -0,0 +1,95 @@
+// knapsack.cpp - exact 0/1 knapsack used to pick programs for a fixed ROM budget
+#include "knapsack.h"
+
+#include <algorithm>
+#include <numeric>
+
+namespace {
+
+struct Solver {
+    std::vector<size_t> cost;      // in density order
+    std::vector<uint64_t> value;
+    std::vector<size_t> index;     // original index of each sorted item
+    size_t max_items;
+
+    std::vector<bool> take, best_take;
+    uint64_t best_value = 0;
+
+    // Upper bound on the value reachable from item k on: the fractional
+    // (LP) relaxation, further capped by the best values that still fit in
+    // the remaining item count
+    double bound(size_t k, size_t room, size_t slots) const {
+        double lp = 0;
+        for (size_t i = k; i < cost.size() && room > 0; i++) {
+            if (cost[i] <= room) {
+                lp += (double)value[i];
+                room -= cost[i];
+            } else {
+                lp += (double)value[i] * (double)room / (double)cost[i];
+                break;
+            }
+        }
+
+        std::vector<uint64_t> rest(value.begin() + k, value.end());
+        size_t n = std::min(slots, rest.size());
+        std::partial_sort(rest.begin(), rest.begin() + n, rest.end(), std::greater<uint64_t>());
+        double top = (double)std::accumulate(rest.begin(), rest.begin() + n, uint64_t(0));
+
+        return std::min(lp, top);
+    }
+
+    void search(size_t k, size_t room, size_t slots, uint64_t val) {
+        if (val > best_value) {
+            best_value = val;
+            best_take = take;
+        }
+        if (k == cost.size() || slots == 0) return;
+        if (bound(k, room, slots) + (double)val < (double)best_value + 1) return;
+
+        if (cost[k] <= room) {
+            take[k] = true;
+            search(k + 1, room - cost[k], slots - 1, val + value[k]);
+            take[k] = false;
+        }
+        search(k + 1, room, slots, val);
+    }
+};
+
+} // namespace
+
+std::vector<size_t> knapsack_select(const std::vector<size_t>& cost,
+                                    const std::vector<uint64_t>& value,
+                                    size_t capacity, size_t max_items) {
+    // Fold the tie-break into the objective: scaled by capacity+1, one unit of
+    // value outweighs any number of bytes, and every byte used costs one
+    std::vector<uint64_t> score(cost.size());
+    for (size_t i = 0; i < cost.size(); i++) {
+        score[i] = value[i] * (uint64_t)(capacity + 1) - std::min(cost[i], capacity);
+    }
+
+    std::vector<size_t> order(cost.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        // value[a]/cost[a] > value[b]/cost[b], without dividing
+        return (double)score[a] * (double)std::max<size_t>(cost[b], 1)
+             > (double)score[b] * (double)std::max<size_t>(cost[a], 1);
+    });
+
+    Solver s;
+    s.max_items = max_items;
+    for (size_t i : order) {
+        s.cost.push_back(cost[i]);
+        s.value.push_back(score[i]);
+        s.index.push_back(i);
+    }
+    s.take.assign(order.size(), false);
+    s.best_take = s.take;
+    s.search(0, capacity, max_items, 0);
+
+    std::vector<size_t> chosen;
+    for (size_t k = 0; k < order.size(); k++) {
+        if (s.best_take[k]) chosen.push_back(s.index[k]);
+    }
+    std::sort(chosen.begin(), chosen.end());
+    return chosen;
+}
@@ -0,0 +1,14 @@
+// knapsack.h - exact 0/1 knapsack used to pick programs for a fixed ROM budget
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Returns the indices (ascending) of the subset with the highest total value
+// whose total cost fits in capacity, using at most max_items items. Among
+// equally valuable subsets the one using fewer bytes wins. Branch and bound
+// over items in value density order, so typical compilations solve instantly.
+std::vector<size_t> knapsack_select(const std::vector<size_t>& cost,
+                                    const std::vector<uint64_t>& value,
+                                    size_t capacity, size_t max_items);
@@ -9,3 +9,31 @@ unsigned char loader_bin[] = {
   0xe1, 0x30, 0xc5, 0x87, 0xc0, 0x7e, 0x23, 0x17, 0xc9
 };
 unsigned int loader_bin_len = 93;
+unsigned char loader_turbo_bin[] = {
+  0x21, 0x70, 0x20, 0x11, 0x09, 0x40, 0xcd, 0x18, 0x20, 0xfd, 0x36, 0x00,
+  0xff, 0xaf, 0x32, 0x06, 0x40, 0xfd, 0x36, 0x01, 0xc0, 0xc3, 0x2b, 0x0f,
+  0x3e, 0x80, 0xed, 0xa0, 0x87, 0xcc, 0x6c, 0x20, 0x30, 0xf8, 0xd5, 0x01,
+  0x01, 0x00, 0x50, 0x14, 0x87, 0xcc, 0x6c, 0x20, 0x30, 0xf9, 0xc3, 0x3b,
+  0x20, 0x87, 0xcc, 0x6c, 0x20, 0xcb, 0x11, 0xcb, 0x10, 0x38, 0x2d, 0x15,
+  0x20, 0xf3, 0x03, 0x5e, 0x23, 0xcb, 0x33, 0x30, 0x1a, 0x87, 0xcc, 0x6c,
+  0x20, 0xcb, 0x12, 0x87, 0xcc, 0x6c, 0x20, 0xcb, 0x12, 0x87, 0xcc, 0x6c,
+  0x20, 0xcb, 0x12, 0x87, 0xcc, 0x6c, 0x20, 0x3f, 0x38, 0x01, 0x14, 0xcb,
+  0x1b, 0xe3, 0xe5, 0xed, 0x52, 0xd1, 0xed, 0xb0, 0xe1, 0xd2, 0x1c, 0x20,
+  0x7e, 0x23, 0x17, 0xc9
+};
+unsigned int loader_turbo_bin_len = 112;
+unsigned char loader_mega_bin[] = {
+  0x21, 0x8e, 0x20, 0x11, 0x09, 0x40, 0xcd, 0x18, 0x20, 0xfd, 0x36, 0x00,
+  0xff, 0xaf, 0x32, 0x06, 0x40, 0xfd, 0x36, 0x01, 0xc0, 0xc3, 0x2b, 0x0f,
+  0x3e, 0x80, 0xed, 0xa0, 0x87, 0x28, 0x48, 0x30, 0xf9, 0xd5, 0x01, 0x01,
+  0x00, 0x50, 0x14, 0x87, 0x28, 0x44, 0x30, 0xfa, 0x15, 0x28, 0x0c, 0x87,
+  0x28, 0x43, 0xcb, 0x11, 0xcb, 0x10, 0x38, 0x2d, 0x15, 0x20, 0xf4, 0x03,
+  0x5e, 0x23, 0xcb, 0x33, 0x30, 0x16, 0x87, 0x28, 0x35, 0xcb, 0x12, 0x87,
+  0x28, 0x35, 0xcb, 0x12, 0x87, 0x28, 0x35, 0xcb, 0x12, 0x87, 0x28, 0x35,
+  0x3f, 0x38, 0x01, 0x14, 0xcb, 0x1b, 0xe3, 0xe5, 0xed, 0x52, 0xd1, 0xed,
+  0xb0, 0xe1, 0xc3, 0x1c, 0x20, 0xe1, 0xc9, 0x7e, 0x23, 0x17, 0x30, 0xae,
+  0x18, 0xb3, 0x7e, 0x23, 0x17, 0x30, 0xb3, 0x18, 0xb7, 0x7e, 0x23, 0x17,
+  0x18, 0xb8, 0x7e, 0x23, 0x17, 0x18, 0xc6, 0x7e, 0x23, 0x17, 0x18, 0xc6,
+  0x7e, 0x23, 0x17, 0x18, 0xc6, 0x7e, 0x23, 0x17, 0x18, 0xc6
+};
+unsigned int loader_mega_bin_len = 142;
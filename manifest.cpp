@@ -0,0 +1,122 @@
+// manifest.cpp - ROM definitions for batch builds
+#include "manifest.h"
+#include "cache.h"
+
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+std::string trim(const std::string& s) {
+    size_t b = s.find_first_not_of(" \t\r");
+    if (b == std::string::npos) return "";
+    size_t e = s.find_last_not_of(" \t\r");
+    return s.substr(b, e - b + 1);
+}
+
+bool parse_bool(const std::string& v, bool& out) {
+    if (v == "yes" || v == "true" || v == "1") { out = true; return true; }
+    if (v == "no" || v == "false" || v == "0") { out = false; return true; }
+    return false;
+}
+
+} // namespace
+
+bool parse_eprom(const std::string& text, size_t& banks) {
+    static const struct { const char* name; size_t banks; } types[] = {
+        {"27C128", 1}, {"27C256", 2}, {"27C512", 4}, {"27C010", 8}, {"27C1001", 8},
+    };
+    std::string upper;
+    for (char c : text) upper += (char)std::toupper((unsigned char)c);
+    for (const auto& t : types) {
+        if (upper == t.name) { banks = t.banks; return true; }
+    }
+
+    uint64_t bytes = 0;
+    if (!parse_size(text, bytes) || bytes == 0 || bytes % 16384 != 0) return false;
+    banks = (size_t)(bytes / 16384);
+    return true;
+}
+
+static const char* const decoder_names[] = { "auto", "standard", "turbo", "mega" };
+
+bool parse_decoder(const std::string& text, Decoder& decoder) {
+    for (size_t i = 0; i < sizeof decoder_names / sizeof decoder_names[0]; i++) {
+        if (text == decoder_names[i]) { decoder = (Decoder)i; return true; }
+    }
+    return false;
+}
+
+const char* decoder_name(Decoder decoder) {
+    return decoder_names[(size_t)decoder];
+}
+
+std::vector<RomSpec> read_manifest(const std::string& path) {
+    std::ifstream f(path);
+    if (!f) throw std::runtime_error("Cannot open manifest: " + path);
+
+    auto slash = path.find_last_of('/');
+    std::string dir = (slash == std::string::npos) ? "" : path.substr(0, slash + 1);
+    auto resolve = [&](const std::string& p) {
+        return (p.empty() || p[0] == '/') ? p : dir + p;
+    };
+
+    std::vector<RomSpec> roms;
+    std::string line;
+    for (int line_no = 1; std::getline(f, line); line_no++) {
+        auto hash = line.find('#');
+        if (hash != std::string::npos) line.resize(hash);
+        line = trim(line);
+        if (line.empty()) continue;
+
+        auto fail = [&](const std::string& what) {
+            throw std::runtime_error(path + ":" + std::to_string(line_no) + ": " + what);
+        };
+
+        if (line.front() == '[') {
+            if (line.back() != ']') fail("unterminated ROM header");
+            RomSpec spec;
+            spec.output = resolve(trim(line.substr(1, line.size() - 2)));
+            if (spec.output.empty()) fail("empty ROM name");
+            roms.push_back(spec);
+            continue;
+        }
+
+        auto eq = line.find('=');
+        if (eq == std::string::npos) fail("expected key = value");
+        if (roms.empty()) fail("setting outside of a [rom] section");
+        std::string key = trim(line.substr(0, eq));
+        std::string value = trim(line.substr(eq + 1));
+        RomSpec& spec = roms.back();
+
+        if (key == "base") {
+            spec.base_path = resolve(value);
+        } else if (key == "loader") {
+            spec.loader_path = resolve(value);
+        } else if (key == "menu") {
+            if (value != "full" && value != "simple") fail("menu must be 'full' or 'simple'");
+            spec.simple_menu = (value == "simple");
+        } else if (key == "force-loader") {
+            if (!parse_bool(value, spec.force_loader)) fail("force-loader must be yes or no");
+        } else if (key == "eprom") {
+            if (!parse_eprom(value, spec.eprom_banks)) fail("unknown EPROM type '" + value + "'");
+        } else if (key == "decoder") {
+            if (!parse_decoder(value, spec.decoder)) fail("unknown decoder '" + value + "'");
+        } else if (key == "input") {
+            spec.inputs.push_back(resolve(value));
+        } else if (key == "inputs") {
+            std::istringstream words(value);
+            for (std::string w; words >> w; ) spec.inputs.push_back(resolve(w));
+        } else {
+            fail("unknown key '" + key + "'");
+        }
+    }
+
+    for (const auto& spec : roms) {
+        if (spec.inputs.empty()) throw std::runtime_error(path + ": " + spec.output + " has no inputs");
+    }
+    if (roms.empty()) throw std::runtime_error(path + ": no ROMs defined");
+    return roms;
+}
@@ -0,0 +1,47 @@
+// manifest.h - ROM definitions for batch builds
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// ZX7 decoder in the embedded loaders, slowest and smallest first. Auto picks
+// the fastest one that leaves room for the payload.
+enum class Decoder { Auto, Standard, Turbo, Mega };
+
+// One ROM to build; the single-image command line fills in exactly one of these
+struct RomSpec {
+    std::string output;
+    std::string base_path;    // empty: embedded base ROM
+    std::string loader_path;  // empty: embedded loader
+    bool simple_menu = false;
+    bool force_loader = false;
+    Decoder decoder = Decoder::Auto;
+    size_t eprom_banks = 0;   // 0: one 16K image, else an EPROM of this many 16K banks
+    bool select = false;      // pick the most valuable subset of inputs that fits
+    bool sysvar_dict = false; // loader primes RAM with the sysvar template (--sysvar-dict, all ROMs)
+    std::vector<std::string> inputs;
+    std::vector<uint64_t> priorities;  // per input when selecting, default 1
+};
+
+// EPROM type such as "27C512", or a size such as "64K", as a count of 16K banks
+bool parse_eprom(const std::string& text, size_t& banks);
+
+// "auto", "standard", "turbo" or "mega"
+bool parse_decoder(const std::string& text, Decoder& decoder);
+const char* decoder_name(Decoder decoder);
+
+// Reads a batch manifest. Each ROM starts with a "[output.rom]" header and is
+// followed by "key = value" lines:
+//
+//   [games.rom]
+//   base   = custom8k.rom        (optional)
+//   loader = myloader.bin        (optional, needs force-loader for menus)
+//   menu   = full | simple       (optional, default full)
+//   force-loader = yes | no      (optional)
+//   eprom  = 27C512              (optional, spread programs over 16K banks)
+//   decoder = auto | standard | turbo | mega   (optional, default auto)
+//   inputs = game1.p game2.p     (repeatable, or use "input = one file.p")
+//
+// '#' starts a comment. Relative paths are taken relative to the manifest.
+std::vector<RomSpec> read_manifest(const std::string& path);
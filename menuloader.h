@@ -22,3 +22,57 @@ unsigned char menuloader_bin[] = {
   0x27, 0x00, 0x34, 0x37, 0x00, 0x1d, 0x16
 };
 unsigned int menuloader_bin_len = 247;
+unsigned char menuloader_turbo_bin[] = {
+  0xcd, 0x2a, 0x0a, 0x01, 0xfd, 0x20, 0x0a, 0xfe, 0x09, 0x28, 0x04, 0xd7,
+  0x03, 0x18, 0xf7, 0xf3, 0xcd, 0x2b, 0x0f, 0xcd, 0x4b, 0x0f, 0x0e, 0xfe,
+  0x06, 0xf7, 0xed, 0x78, 0xcb, 0x47, 0x20, 0x05, 0x21, 0x00, 0x20, 0x18,
+  0x68, 0xcb, 0x4f, 0x20, 0x05, 0x21, 0x00, 0x20, 0x18, 0x5f, 0xcb, 0x57,
+  0x20, 0x05, 0x21, 0x00, 0x20, 0x18, 0x56, 0xcb, 0x5f, 0x20, 0x05, 0x21,
+  0x00, 0x20, 0x18, 0x4d, 0xcb, 0x67, 0x20, 0x05, 0x21, 0x00, 0x20, 0x18,
+  0x44, 0x06, 0xef, 0xed, 0x78, 0xcb, 0x47, 0x20, 0x05, 0x21, 0x00, 0x20,
+  0x18, 0x37, 0xcb, 0x4f, 0x20, 0x05, 0x21, 0x00, 0x20, 0x18, 0x2e, 0xcb,
+  0x57, 0x20, 0x05, 0x21, 0x00, 0x20, 0x18, 0x25, 0xcb, 0x5f, 0x20, 0x05,
+  0x21, 0x00, 0x20, 0x18, 0x1c, 0x06, 0x7f, 0xed, 0x78, 0xcb, 0x67, 0x20,
+  0x12, 0xfd, 0x36, 0x00, 0xff, 0xaf, 0x32, 0x06, 0x40, 0xfd, 0x36, 0x01,
+  0x40, 0xd3, 0xfe, 0xfb, 0xc3, 0x76, 0x06, 0x18, 0x8b, 0xcd, 0xe7, 0x02,
+  0x11, 0x09, 0x40, 0xcd, 0xa5, 0x20, 0xfd, 0x36, 0x00, 0xff, 0xaf, 0x32,
+  0x06, 0x40, 0xfd, 0x36, 0x01, 0xc0, 0xc3, 0x2b, 0x0f, 0x3e, 0x80, 0xed,
+  0xa0, 0x87, 0xcc, 0xf9, 0x20, 0x30, 0xf8, 0xd5, 0x01, 0x01, 0x00, 0x50,
+  0x14, 0x87, 0xcc, 0xf9, 0x20, 0x30, 0xf9, 0xc3, 0xc8, 0x20, 0x87, 0xcc,
+  0xf9, 0x20, 0xcb, 0x11, 0xcb, 0x10, 0x38, 0x2d, 0x15, 0x20, 0xf3, 0x03,
+  0x5e, 0x23, 0xcb, 0x33, 0x30, 0x1a, 0x87, 0xcc, 0xf9, 0x20, 0xcb, 0x12,
+  0x87, 0xcc, 0xf9, 0x20, 0xcb, 0x12, 0x87, 0xcc, 0xf9, 0x20, 0xcb, 0x12,
+  0x87, 0xcc, 0xf9, 0x20, 0x3f, 0x38, 0x01, 0x14, 0xcb, 0x1b, 0xe3, 0xe5,
+  0xed, 0x52, 0xd1, 0xed, 0xb0, 0xe1, 0xd2, 0xa9, 0x20, 0x7e, 0x23, 0x17,
+  0xc9, 0x35, 0x37, 0x2a, 0x38, 0x38, 0x00, 0x27, 0x00, 0x34, 0x37, 0x00,
+  0x1d, 0x16
+};
+unsigned int menuloader_turbo_bin_len = 266;
+unsigned char menuloader_mega_bin[] = {
+  0xcd, 0x2a, 0x0a, 0x01, 0x1b, 0x21, 0x0a, 0xfe, 0x09, 0x28, 0x04, 0xd7,
+  0x03, 0x18, 0xf7, 0xf3, 0xcd, 0x2b, 0x0f, 0xcd, 0x4b, 0x0f, 0x0e, 0xfe,
+  0x06, 0xf7, 0xed, 0x78, 0xcb, 0x47, 0x20, 0x05, 0x21, 0x00, 0x20, 0x18,
+  0x68, 0xcb, 0x4f, 0x20, 0x05, 0x21, 0x00, 0x20, 0x18, 0x5f, 0xcb, 0x57,
+  0x20, 0x05, 0x21, 0x00, 0x20, 0x18, 0x56, 0xcb, 0x5f, 0x20, 0x05, 0x21,
+  0x00, 0x20, 0x18, 0x4d, 0xcb, 0x67, 0x20, 0x05, 0x21, 0x00, 0x20, 0x18,
+  0x44, 0x06, 0xef, 0xed, 0x78, 0xcb, 0x47, 0x20, 0x05, 0x21, 0x00, 0x20,
+  0x18, 0x37, 0xcb, 0x4f, 0x20, 0x05, 0x21, 0x00, 0x20, 0x18, 0x2e, 0xcb,
+  0x57, 0x20, 0x05, 0x21, 0x00, 0x20, 0x18, 0x25, 0xcb, 0x5f, 0x20, 0x05,
+  0x21, 0x00, 0x20, 0x18, 0x1c, 0x06, 0x7f, 0xed, 0x78, 0xcb, 0x67, 0x20,
+  0x12, 0xfd, 0x36, 0x00, 0xff, 0xaf, 0x32, 0x06, 0x40, 0xfd, 0x36, 0x01,
+  0x40, 0xd3, 0xfe, 0xfb, 0xc3, 0x76, 0x06, 0x18, 0x8b, 0xcd, 0xe7, 0x02,
+  0x11, 0x09, 0x40, 0xcd, 0xa5, 0x20, 0xfd, 0x36, 0x00, 0xff, 0xaf, 0x32,
+  0x06, 0x40, 0xfd, 0x36, 0x01, 0xc0, 0xc3, 0x2b, 0x0f, 0x3e, 0x80, 0xed,
+  0xa0, 0x87, 0x28, 0x48, 0x30, 0xf9, 0xd5, 0x01, 0x01, 0x00, 0x50, 0x14,
+  0x87, 0x28, 0x44, 0x30, 0xfa, 0x15, 0x28, 0x0c, 0x87, 0x28, 0x43, 0xcb,
+  0x11, 0xcb, 0x10, 0x38, 0x2d, 0x15, 0x20, 0xf4, 0x03, 0x5e, 0x23, 0xcb,
+  0x33, 0x30, 0x16, 0x87, 0x28, 0x35, 0xcb, 0x12, 0x87, 0x28, 0x35, 0xcb,
+  0x12, 0x87, 0x28, 0x35, 0xcb, 0x12, 0x87, 0x28, 0x35, 0x3f, 0x38, 0x01,
+  0x14, 0xcb, 0x1b, 0xe3, 0xe5, 0xed, 0x52, 0xd1, 0xed, 0xb0, 0xe1, 0xc3,
+  0xa9, 0x20, 0xe1, 0xc9, 0x7e, 0x23, 0x17, 0x30, 0xae, 0x18, 0xb3, 0x7e,
+  0x23, 0x17, 0x30, 0xb3, 0x18, 0xb7, 0x7e, 0x23, 0x17, 0x18, 0xb8, 0x7e,
+  0x23, 0x17, 0x18, 0xc6, 0x7e, 0x23, 0x17, 0x18, 0xc6, 0x7e, 0x23, 0x17,
+  0x18, 0xc6, 0x7e, 0x23, 0x17, 0x18, 0xc6, 0x35, 0x37, 0x2a, 0x38, 0x38,
+  0x00, 0x27, 0x00, 0x34, 0x37, 0x00, 0x1d, 0x16
+};
+unsigned int menuloader_mega_bin_len = 296;
@@ -0,0 +1,52 @@
+// parallel.h - minimal worker pool used to spread independent jobs over cores
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+
+// Number of workers to use when the user didn't ask for a specific count
+static inline unsigned default_jobs() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+// Runs fn(i, worker) for every i in [0, count) on up to `jobs` threads, where
+// worker is a stable index below the number of threads used, handy for
+// per-thread scratch state. Jobs are handed out in index order; the first
+// exception (by index) is rethrown once all workers have finished, so callers
+// see the same error a serial loop would give.
+static inline unsigned worker_count(size_t count, unsigned jobs) {
+    return count == 0 ? 0 : std::max(1u, std::min<unsigned>(jobs, (unsigned)std::min<size_t>(count, ~0u)));
+}
+
+template <typename Fn>
+void parallel_for(size_t count, unsigned jobs, Fn fn) {
+    if (count == 0) return;
+    jobs = worker_count(count, jobs);
+
+    std::vector<std::exception_ptr> errors(count);
+    std::atomic<size_t> next{0};
+
+    auto worker = [&](unsigned id) {
+        for (size_t i; (i = next.fetch_add(1)) < count; ) {
+            try {
+                fn(i, id);
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 1; t < jobs; t++) threads.emplace_back(worker, t);
+    worker(0);
+    for (auto& t : threads) t.join();
+
+    for (auto& e : errors) {
+        if (e) std::rethrow_exception(e);
+    }
+}
@@ -0,0 +1,66 @@
+// pfile.cpp - the layout of a P-file, and compacting it to what LOAD reads
+#include "pfile.h"
+#include "sysvars.h"
+
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+const uint16_t VERSN = 0x4009;
+const uint16_t D_FILE = 0x400C;
+const uint16_t VARS = 0x4010;
+const uint16_t E_LINE = 0x4014;
+
+const uint8_t HALT = 0x76;     // ends every display line
+const uint8_t VARS_END = 0x80;  // ends the variables
+
+uint16_t word(ByteView data, size_t at) {
+    return (uint16_t)(data[at] | data[at + 1] << 8);
+}
+
+// The system variable at address var, as "NAME ($xxxx)"
+std::string sysvar(ByteView pfile, const char* name, uint16_t var) {
+    char text[24];
+    std::snprintf(text, sizeof text, "%s ($%04X)", name, word(pfile, var - VERSN));
+    return text;
+}
+
+} // namespace
+
+PFileLayout parse_pfile(ByteView pfile) {
+    if (pfile.size() < SYSVARS_SIZE) throw std::runtime_error("shorter than the system variables");
+    const uint16_t d_file = word(pfile, D_FILE - VERSN);
+    const uint16_t vars = word(pfile, VARS - VERSN);
+    const uint16_t e_line = word(pfile, E_LINE - VERSN);
+    if (d_file < VERSN + SYSVARS_SIZE) {
+        throw std::runtime_error(sysvar(pfile, "D_FILE", D_FILE) + " points into the system variables");
+    }
+    if (vars <= d_file) {
+        throw std::runtime_error(sysvar(pfile, "VARS", VARS) + " is not after " + sysvar(pfile, "D_FILE", D_FILE));
+    }
+    if (e_line <= vars) {
+        throw std::runtime_error(sysvar(pfile, "E_LINE", E_LINE) + " is not after " + sysvar(pfile, "VARS", VARS));
+    }
+    if ((size_t)(e_line - VERSN) > pfile.size()) {
+        throw std::runtime_error(sysvar(pfile, "E_LINE", E_LINE) + " is past the end of its "
+                                 + std::to_string(pfile.size()) + " bytes");
+    }
+
+    PFileLayout layout;
+    layout.program = SYSVARS_SIZE;
+    layout.display = d_file - VERSN;
+    layout.variables = vars - VERSN;
+    layout.end = e_line - VERSN;
+    if (pfile[layout.display] != HALT) throw std::runtime_error("the display file doesn't start with a HALT");
+    if (pfile[layout.end - 1] != VARS_END) throw std::runtime_error("the variables don't end in $80");
+    return layout;
+}
+
+size_t compact_pfile(std::vector<uint8_t>& pfile) {
+    const PFileLayout layout = parse_pfile(pfile);
+    const size_t trimmed = pfile.size() - layout.end;
+    pfile.resize(layout.end);
+    return trimmed;
+}
@@ -0,0 +1,26 @@
+// pfile.h - the layout of a P-file, and compacting it to what LOAD reads
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "bytes.h"
+
+// Where the parts of a P-file start, as offsets from VERSN ($4009): the system
+// variables, the program from 116, then the display file, the variables and
+// the end, E_LINE, where LOAD stops reading
+struct PFileLayout {
+    size_t program = 0;
+    size_t display = 0;
+    size_t variables = 0;
+    size_t end = 0;
+};
+
+// Reads the layout from the system variables; throws std::runtime_error if
+// they don't describe the file
+PFileLayout parse_pfile(ByteView pfile);
+
+// Drops whatever follows E_LINE, which LOAD never reads, and returns how many
+// bytes that was. Throws like parse_pfile().
+size_t compact_pfile(std::vector<uint8_t>& pfile);
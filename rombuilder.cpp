@@ -0,0 +1,1395 @@
+// rombuilder.cpp - libp2rom: ZX81 ROM and EPROM images built from P-files held in memory
+#include "rombuilder.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <stdexcept>
+
+#include "base.h"
+#include "loader.h"
+#include "menuloader.h"
+#include "parallel.h"
+#include "sha256.h"
+#include "knapsack.h"
+#include "dzx7.h"
+#include "sysvars.h"
+#include "pfile.h"
+
+struct CompressedPFile {
+    std::string original_name;
+    ByteView compressed_data;  // owned by its SourceFile
+    size_t offset;  // Offset in ROM where this P-file is stored
+    size_t raw_size;  // Size before compression (0 if it was already ZX7)
+    bool from_cache = false;
+    ByteView source;  // the input P-file, for --verify; empty for ZX7 inputs
+    bool sysvar_dict = false;  // decoded after the sysvar template, matching into it
+};
+
+using ZX7ContextPtr = std::unique_ptr<ZX7Context, decltype(&zx7_destroy)>;
+
+// A program is loaded at VERSN ($4009) and has to end below the top of 16K RAM
+const size_t MAX_PROGRAM = 0x8000 - 0x4009;
+
+// Stands in where nothing is to be recorded
+static BuildStats no_stats;
+
+// Stands in where no cache is used
+static const CompressionCache no_cache("", 0);
+
+static ZX7ContextPtr make_zx7_context(const EncoderOptions& options, size_t reserve) {
+    ZX7ContextPtr ctx(zx7_create(), &zx7_destroy);
+    if (ctx) {
+        ctx->parse = options.parse;
+        ctx->match_finder = options.match_finder;
+        ctx->speed = options.speed;
+    }
+    if (!ctx || zx7_reserve(ctx.get(), reserve) != ZX7_OK) {
+        throw std::runtime_error("ZX7 compress failed: out of memory");
+    }
+    return ctx;
+}
+
+// Everything besides the input bytes that changes what zx7_encode() produces
+static std::string encoder_settings(const EncoderOptions& options) {
+    const char* parse = options.parse == ZX7_PARSE_GREEDY ? "greedy"
+                      : options.parse == ZX7_PARSE_LAZY   ? "lazy" : "optimal";
+    std::string settings = std::string(parse) + ";skip=0";
+    if (options.split) settings += ";split=" + std::to_string(options.split);
+    if (options.speed) settings += ";speed=" + std::to_string(options.speed);
+    if (options.sysvar_dict) settings += ";sysvars";
+    return settings;
+}
+
+// Encodes with a caller-owned context, whose workspace is reused across calls;
+// the first skip bytes are only a dictionary. The parse and the writing of the
+// stream are timed as stages of subject.
+static std::vector<unsigned char> zx7_encode(ZX7Context* ctx, ByteView raw, long skip = 0,
+                                      BuildStats& stats = no_stats, const std::string& subject = "") {
+    if (raw.size() <= (size_t)skip) throw std::runtime_error("empty input");
+
+    long  delta = 0;
+    size_t out_sz = 0;
+    unsigned char* out = nullptr;
+
+    int result;
+    {
+        BuildStats::Stage timing(stats, "optimize", subject);
+        result = zx7_parse(ctx, raw.data(), raw.size(), skip);
+    }
+    if (result == ZX7_OK) {
+        BuildStats::Stage timing(stats, "compress", subject);
+        result = zx7_write(ctx, raw.data(), raw.size(), skip, &out, &out_sz, &delta);
+    }
+    if (result == ZX7_ERR_MEMORY) throw std::runtime_error("ZX7 compress failed: out of memory");
+    if (result != ZX7_OK || out_sz == 0) throw std::runtime_error("ZX7 compress failed");
+
+    return std::vector<unsigned char>(out, out + out_sz);
+}
+
+// One input parsed as independent segments, e.g. on several cores. Each segment
+// gets the MAX_OFFSET bytes before it as a dictionary, so every match it picks is
+// valid in the whole input. Joined, the segments form one stream whose only
+// difference from theirs is that each segment's first byte, a bare literal in a
+// stream of its own, becomes a flagged literal costing one bit more.
+struct SplitParse {
+    std::vector<size_t> bounds;          // segment k covers [bounds[k], bounds[k+1]); bounds[0] skips a dictionary
+    std::vector<uint16_t> offset, len;   // per position, as in ZX7Context
+    std::vector<uint64_t> bits;          // per segment: cost of its own stream
+    std::vector<ZX7Profile> profiles;    // per segment: counters of its parse
+};
+
+static SplitParse plan_split(size_t size, size_t segment, size_t skip) {
+    SplitParse parse;
+    for (size_t first = skip; first < size; first += segment) parse.bounds.push_back(first);
+    parse.bounds.push_back(size);
+    parse.offset.resize(size);
+    parse.len.resize(size);
+    parse.bits.resize(parse.bounds.size() - 1);
+    parse.profiles.resize(parse.bounds.size() - 1);
+    return parse;
+}
+
+// Parses segment k of raw with a caller-owned context
+static void zx7_parse_segment(ZX7Context* ctx, ByteView raw, SplitParse& parse, size_t k,
+                              BuildStats& stats, const std::string& subject) {
+    BuildStats::Stage timing(stats, "optimize", subject);
+    size_t first  = parse.bounds[k];
+    size_t last   = parse.bounds[k + 1];
+    size_t window = first > MAX_OFFSET ? first - MAX_OFFSET : 0;
+
+    ctx->profile = ZX7Profile();
+    int result = zx7_parse(ctx, raw.data() + window, last - window, (long)(first - window));
+    parse.profiles[k] = ctx->profile;
+    if (result == ZX7_ERR_MEMORY) throw std::runtime_error("ZX7 compress failed: out of memory");
+    if (result != ZX7_OK) throw std::runtime_error("ZX7 compress failed");
+
+    std::copy(ctx->optimal_offset + (first - window), ctx->optimal_offset + (last - window), parse.offset.begin() + first);
+    std::copy(ctx->optimal_len + (first - window), ctx->optimal_len + (last - window), parse.len.begin() + first);
+    parse.bits[k] = ctx->optimal_bits[last - window - 1];
+}
+
+// Joins the segments of a split parse and encodes them as one stream
+static std::vector<unsigned char> zx7_encode_split(ZX7Context* ctx, ByteView raw,
+                                                   const SplitParse& parse, BuildStats& stats, const std::string& subject) {
+    const long skip = (long)parse.bounds.front();
+    BuildStats::Stage timing(stats, "compress", subject);
+    if (zx7_reserve(ctx, raw.size()) != ZX7_OK) throw std::runtime_error("ZX7 compress failed: out of memory");
+    std::copy(parse.offset.begin(), parse.offset.end(), ctx->optimal_offset);
+    std::copy(parse.len.begin(), parse.len.end(), ctx->optimal_len);
+    uint64_t bits = 0;
+    for (size_t k = 0; k < parse.bits.size(); k++) bits += parse.bits[k] + (k ? 1 : 0);
+    ctx->optimal_bits[raw.size() - 1] = (uint32_t)bits;
+
+    ctx->profile = ZX7Profile();
+    for (const ZX7Profile& segment : parse.profiles) zx7_profile_add(&ctx->profile, &segment);
+
+    long  delta = 0;
+    size_t out_sz = 0;
+    unsigned char* out = nullptr;
+    int result = zx7_write(ctx, raw.data(), raw.size(), skip, &out, &out_sz, &delta);
+    if (result == ZX7_ERR_MEMORY) throw std::runtime_error("ZX7 compress failed: out of memory");
+    if (result != ZX7_OK || out_sz == 0) throw std::runtime_error("ZX7 compress failed");
+
+    return std::vector<unsigned char>(out, out + out_sz);
+}
+
+static bool ends_with_case_insensitive(const std::string& s, const std::string& suffix) {
+    if (s.size() < suffix.size()) return false;
+    for (size_t i = 0; i < suffix.size(); ++i) {
+        char a = std::tolower((unsigned char)s[s.size() - suffix.size() + i]);
+        char b = std::tolower((unsigned char)suffix[i]);
+        if (a != b) return false;
+    }
+    return true;
+}
+
+static bool is_zx7(const std::string& inputPath) {
+    return ends_with_case_insensitive(inputPath, ".zx7");
+}
+
+static ByteView load_embedded_base() {
+    return ByteView(base8k_rom, base8k_rom_len);
+}
+
+// The embedded loaders are assembled once per ZX7 decoder (asm/loader.asm and
+// asm/menuloader.asm with -DDZX7_TURBO or -DDZX7_MEGA)
+struct EmbeddedLoader {
+    int zx7_decoder;  // ZX7_DZX7_*, for the T-state model
+    const unsigned char* single;
+    unsigned int single_len;
+    const unsigned char* menu;
+    unsigned int menu_len;
+};
+
+static const EmbeddedLoader& embedded_loader(Decoder decoder) {
+    static const EmbeddedLoader loaders[] = {
+        {ZX7_DZX7_STANDARD, loader_bin, loader_bin_len, menuloader_bin, menuloader_bin_len},
+        {ZX7_DZX7_TURBO, loader_turbo_bin, loader_turbo_bin_len, menuloader_turbo_bin, menuloader_turbo_bin_len},
+        {ZX7_DZX7_MEGA, loader_mega_bin, loader_mega_bin_len, menuloader_mega_bin, menuloader_mega_bin_len},
+    };
+    return loaders[decoder == Decoder::Auto ? 0 : (size_t)decoder - 1];
+}
+
+static ByteView load_embedded_loader(Decoder decoder) {
+    const EmbeddedLoader& l = embedded_loader(decoder);
+    return ByteView(l.single, l.single_len);
+}
+
+static ByteView load_embedded_menuloader(Decoder decoder) {
+    const EmbeddedLoader& l = embedded_loader(decoder);
+    return ByteView(l.menu, l.menu_len);
+}
+
+std::string program_name(const std::string& path) {
+    auto slash = path.find_last_of("/\\");
+    std::string name = (slash == std::string::npos) ? path : path.substr(slash + 1);
+    auto dot = name.find_last_of('.');
+    if (dot != std::string::npos) name.resize(dot);
+    if (name.size() > 2 && name.compare(name.size()-2, 2, ".p") == 0) {
+        name.resize(name.size()-2);
+    }
+
+    return name;
+}
+
+static uint8_t ascii_to_zx81(char c) {
+    // Numbers 0-9
+    if (c >= '0' && c <= '9') return c - 20;          // ASCII 48-57 → ZX81 0x1C-0x25
+    
+    // Letters A-Z  
+    if (c >= 'A' && c <= 'Z') return c - 27;          // ASCII 65-90 → ZX81 0x26-0x3F
+    
+    // Special characters
+    switch (c) {
+        case ' ':  return 0x00;  // ZX_SPACE
+        case '"':  return 0x0B;  // ZX_QUOTE
+        case '#':  return 0x0C;  // ZX_POUND
+        case '$':  return 0x0D;  // ZX_DOLLAR
+        case ':':  return 0x0E;  // ZX_COLON
+        case '?':  return 0x0F;  // ZX_QUERY
+        case '(':  return 0x10;  // ZX_BRACKET_LEFT
+        case ')':  return 0x11;  // ZX_BRACKET_RIGHT
+        case '>':  return 0x12;  // ZX_GREATER_THAN
+        case '<':  return 0x13;  // ZX_LESS_THAN
+        case '=':  return 0x14;  // ZX_EQUAL
+        case '+':  return 0x15;  // ZX_PLUS
+        case '-':  return 0x16;  // ZX_MINUS
+        case '*':  return 0x17;  // ZX_STAR
+        case '/':  return 0x18;  // ZX_SLASH
+        case ';':  return 0x19;  // ZX_SEMICOLON
+        case ',':  return 0x1A;  // ZX_COMMA
+        case '.':  return 0x1B;  // ZX_PERIOD
+        default:   return 0x00;  // Fallback to space for unknown chars
+    }
+}
+
+// A single file uses the loader it is given; a menu only a forced one
+static bool custom_loader(const RomSpec& spec, ByteView loader) {
+    return spec.inputs.size() > 1 ? spec.force_loader : !loader.empty();
+}
+
+// Chooses the loader based on number of P-files
+static std::vector<uint8_t> load_stub(const RomSpec& spec, ByteView loader, Decoder decoder, std::ostream& log) {
+    std::vector<uint8_t> stub;
+    bool use_menu = (spec.inputs.size() > 1);
+
+    if (use_menu) {
+        if(!spec.force_loader)
+        {
+            stub = load_embedded_menuloader(decoder).to_vector();
+            log << "[info] Using menu loader for " << spec.inputs.size() << " P-files (dzx7_"
+                << decoder_name(decoder) << ")\n";
+        } else {
+            if (loader.empty()) throw std::runtime_error("A forced menu loader needs a loader file");
+            stub = loader.to_vector();
+            log << "[note] Using custom menu loader for " << spec.inputs.size() << " P-files\n";
+        }
+    } else if (custom_loader(spec, loader)) {
+        stub = loader.to_vector();
+        log << "[info] Using single-file loader " << spec.loader_path << "\n";
+    } else {
+        stub = load_embedded_loader(decoder).to_vector();
+        log << "[info] Using single-file loader (dzx7_" << decoder_name(decoder) << ")\n";
+    }
+
+    const bool embedded = !custom_loader(spec, loader);
+    if (spec.sysvar_dict) {
+        if (!embedded) throw std::runtime_error("--sysvar-dict needs the embedded loaders");
+        if (!add_sysvar_primer(stub, use_menu)) throw std::runtime_error("Loader has no place for the sysvar primer");
+        log << "[info] Sysvar dictionary: " << sysvar_primer_size() << " bytes of primer in the loader\n";
+    }
+
+    if (stub.size() > 8192) throw std::runtime_error("Loader too large for upper 8K");
+    return stub;
+}
+
+// One distinct input, shared by every ROM that lists a file with the same contents.
+// Its bytes stay where the caller holds them or where they were compressed;
+// the files built from it only refer to them.
+struct SourceFile {
+    std::string path;
+    bool zx7 = false;
+    std::vector<uint8_t> edited;      // the input after --compact
+    ByteView raw;                     // the input: file, or edited
+    std::vector<uint8_t> compressed;  // the encoder's output
+    ByteView stream;                  // the payload: compressed, raw for ZX7 inputs, or an earlier source's
+    size_t raw_size = 0;
+    bool from_cache = false;
+    bool duplicate = false;  // same contents as an earlier source, not compressed again
+    bool split = false;      // parsed in segments (--split)
+    size_t trimmed = 0;      // bytes --compact took off the end of raw
+    size_t unsplit_size = 0; // with --split-report: size when compressed in one piece
+    ZX7Profile profile = {}; // compressor counters, in PROFILE=1 builds
+};
+
+struct CompressStats {
+    size_t workers = 0;
+    size_t peak_bytes = 0;
+};
+
+// Compresses every source on a worker pool. Sources with identical contents are
+// compressed once; results land in input order so images match a serial build.
+// With --split, inputs larger than a segment are parsed one segment per task,
+// so a single large file spreads over the pool too.
+static CompressStats compress_sources(std::vector<SourceFile>& sources, const EncoderOptions& options,
+                                      unsigned jobs, const CompressionCache& cache, BuildStats& stats) {
+    std::vector<size_t> unique;
+    std::map<std::pair<bool, Sha256::Digest>, size_t> seen;
+    std::vector<size_t> same_as(sources.size());
+    size_t largest_raw = 0;
+
+    for (size_t i = 0; i < sources.size(); i++) {
+        BuildStats::Stage timing(stats, "hash", sources[i].path);
+        Sha256 h;
+        h.update(sources[i].raw.data(), sources[i].raw.size());
+        auto it = seen.emplace(std::make_pair(sources[i].zx7, h.finish()), i).first;
+        same_as[i] = it->second;
+        if (it->second != i) {
+            sources[i].duplicate = true;
+            continue;
+        }
+        unique.push_back(i);
+        if (!sources[i].zx7) largest_raw = std::max(largest_raw, sources[i].raw.size());
+    }
+
+    // One compressor workspace per worker, created on first use and sized once
+    // for the largest input
+    std::vector<ZX7ContextPtr> contexts;
+    for (unsigned w = 0; w < (largest_raw ? jobs : 0); w++) contexts.emplace_back(nullptr, &zx7_destroy);
+    auto context = [&](unsigned worker) {
+        if (!contexts[worker]) {
+            contexts[worker] = make_zx7_context(options, largest_raw + (options.sysvar_dict ? SYSVARS_SIZE : 0));
+        }
+        return contexts[worker].get();
+    };
+    const std::string settings = encoder_settings(options);
+
+    // Whole files: cache hits, and everything not split
+    std::vector<std::string> keys(sources.size());
+    auto store = [&](size_t i) {
+        if (!cache.enabled()) return;
+        BuildStats::Stage timing(stats, "cache", sources[i].path);
+        cache.store(keys[i], sources[i].raw.size(), sources[i].compressed);
+    };
+    parallel_for(unique.size(), jobs, [&](size_t u, unsigned worker) {
+        SourceFile& src = sources[unique[u]];
+        src.raw_size = src.zx7 ? 0 : src.raw.size();
+        if (src.zx7) {
+            src.stream = src.raw;
+            return;
+        }
+
+        src.split = options.split && src.raw.size() > options.split;
+        if (options.sysvar_dict) {
+            std::string problem = sysvar_check(src.raw, MAX_PROGRAM);
+            if (!problem.empty()) throw std::runtime_error(src.path + ": " + problem + " (--sysvar-dict)");
+        }
+        if (cache.enabled()) {
+            BuildStats::Stage timing(stats, "cache", src.path);
+            keys[unique[u]] = CompressionCache::key(src.raw, settings);
+            src.from_cache = cache.lookup(keys[unique[u]], src.raw.size(), src.compressed);
+        }
+        if (!src.from_cache && !src.split) {
+            ZX7Context* ctx = context(worker);
+            ctx->profile = ZX7Profile();
+            src.compressed = options.sysvar_dict
+                ? zx7_encode(ctx, with_sysvar_template(src.raw), SYSVARS_SIZE, stats, src.path)
+                : zx7_encode(ctx, src.raw, 0, stats, src.path);
+            src.profile = ctx->profile;
+            store(unique[u]);
+        }
+    });
+
+    // Split files: one task per segment, then one per file to join them
+    std::vector<size_t> split;
+    for (size_t i : unique) {
+        if (sources[i].split && !sources[i].from_cache) split.push_back(i);
+    }
+    std::vector<SplitParse> parses(split.size());
+    std::vector<std::vector<uint8_t>> primed(options.sysvar_dict ? split.size() : 0);
+    auto input = [&](size_t s) {
+        return options.sysvar_dict ? ByteView(primed[s]) : sources[split[s]].raw;
+    };
+    std::vector<std::pair<size_t, size_t>> segments;
+    for (size_t s = 0; s < split.size(); s++) {
+        if (options.sysvar_dict) primed[s] = with_sysvar_template(sources[split[s]].raw);
+        parses[s] = plan_split(input(s).size(), options.split, options.sysvar_dict ? SYSVARS_SIZE : 0);
+        for (size_t k = 0; k + 1 < parses[s].bounds.size(); k++) segments.emplace_back(s, k);
+    }
+    parallel_for(segments.size(), jobs, [&](size_t t, unsigned worker) {
+        size_t s = segments[t].first;
+        zx7_parse_segment(context(worker), input(s), parses[s], segments[t].second, stats, sources[split[s]].path);
+    });
+    parallel_for(split.size(), jobs, [&](size_t s, unsigned worker) {
+        SourceFile& src = sources[split[s]];
+        ZX7Context* ctx = context(worker);
+        src.compressed = zx7_encode_split(ctx, input(s), parses[s], stats, src.path);
+        src.profile = ctx->profile;
+        store(split[s]);
+    });
+
+    // The price of splitting: the same files compressed in one piece
+    if (options.split_report) {
+        EncoderOptions whole = options;
+        whole.split = 0;
+        const std::string whole_settings = encoder_settings(whole);
+        std::vector<size_t> report;
+        for (size_t i : unique) {
+            if (sources[i].split) report.push_back(i);
+        }
+        parallel_for(report.size(), jobs, [&](size_t r, unsigned worker) {
+            SourceFile& src = sources[report[r]];
+            BuildStats::Stage timing(stats, "split-report", src.path);
+            std::string key = cache.enabled() ? CompressionCache::key(src.raw, whole_settings) : "";
+            std::vector<uint8_t> compressed;
+            if (!cache.lookup(key, src.raw.size(), compressed)) {
+                compressed = options.sysvar_dict
+                    ? zx7_encode(context(worker), with_sysvar_template(src.raw), SYSVARS_SIZE)
+                    : zx7_encode(context(worker), src.raw);
+                cache.store(key, src.raw.size(), compressed);
+            }
+            src.unsplit_size = compressed.size();
+        });
+    }
+    cache.trim();
+
+    for (size_t i = 0; i < sources.size(); i++) {
+        if (!sources[i].duplicate && !sources[i].zx7) sources[i].stream = sources[i].compressed;
+    }
+    for (size_t i = 0; i < sources.size(); i++) {
+        if (sources[i].duplicate) {
+            const SourceFile& first = sources[same_as[i]];
+            sources[i].stream = first.stream;
+            sources[i].raw_size = first.raw_size;
+            sources[i].from_cache = first.from_cache;
+            sources[i].split = first.split;
+            sources[i].unsplit_size = first.unsplit_size;
+        }
+    }
+
+    CompressStats workspace;
+    for (const auto& ctx : contexts) {
+        if (ctx) { workspace.peak_bytes += ctx->peak_bytes; workspace.workers++; }
+    }
+    return workspace;
+}
+
+// T-states the loader's decoder spends decoding a stream
+static uint64_t decode_tstates(ByteView zx7, Decoder decoder) {
+    return zx7_tstates(zx7.data(), zx7.size(), embedded_loader(decoder).zx7_decoder);
+}
+
+static void log_compression(const CompressedPFile& pfile, bool from_cache, std::ostream& log) {
+    if (pfile.raw_size == 0) {
+        log << "[info] " << pfile.original_name << " is already ZX7-compressed (" 
+            << pfile.compressed_data.size() << " bytes)\n";
+    } else if (from_cache) {
+        log << "[info] " << pfile.original_name << " found in compression cache ("
+            << pfile.compressed_data.size() << " bytes, from " 
+            << pfile.raw_size << " raw)\n";
+    } else {
+        log << "[info] Compressed " << pfile.original_name << " with ZX7 ("
+            << pfile.compressed_data.size() << " bytes, from " 
+            << pfile.raw_size << " raw)\n";
+    }
+}
+
+// Non-empty buckets of a log2 histogram whose bucket b covers [first(b), first(b+1))
+template <size_t N, typename First>
+static std::string histogram(const uint64_t (&counts)[N], First first) {
+    std::ostringstream out;
+    for (size_t b = 0; b < N; b++) {
+        if (!counts[b]) continue;
+        uint64_t lo = first(b), hi = b + 1 < N ? first(b + 1) - 1 : 0;
+        out << "  " << lo;
+        if (hi != lo) out << (hi ? "-" + std::to_string(hi) : "+");
+        out << ": " << counts[b];
+    }
+    return out.str();
+}
+
+// The compressor's counters for each input compressed in this run (--profile-compressor)
+static void log_profiles(const std::vector<SourceFile>& sources, std::ostream& log) {
+    for (const auto& src : sources) {
+        if (src.zx7 || src.duplicate) continue;
+        if (src.from_cache) {
+            log << "[profile] " << src.path << ": from the compression cache, not profiled\n";
+            continue;
+        }
+        const ZX7Profile& p = src.profile;
+        log << "[profile] " << src.path << ": " << p.literals << " literals, " << p.matches << " matches ("
+            << p.long_offsets << " with offset > 128)\n";
+        log << "[profile]   match lengths:" << histogram(p.len_hist, [](size_t b) { return (uint64_t(1) << b) + 1; })
+            << "\n";
+        log << "[profile]   offsets:" << histogram(p.offset_hist, [](size_t b) { return uint64_t(1) << b; }) << "\n";
+        if (!p.positions) continue;  // the greedy and lazy parses count their output only
+        log << "[profile]   " << p.positions << " positions searched, " << std::fixed << std::setprecision(1)
+            << (double)p.candidates / p.positions << " candidates each (longest " << p.longest_search << "), "
+            << std::defaultfloat << p.compared << " bytes compared, " << p.window_cuts << " searches cut at MAX_OFFSET\n";
+        log << "[profile]   candidates per position:"
+            << histogram(p.search_hist, [](size_t b) { return b ? uint64_t(1) << (b - 1) : 0; }) << "\n";
+    }
+}
+
+// Bytes of menu text the builder writes after the menu loader for one entry:
+// a newline, "n) NAME" and another newline
+static size_t menu_entry_size(size_t index, const std::string& name) {
+    return 1 + std::to_string(index + 1).size() + 2 + name.size() + 1;
+}
+
+// Whole menu block: the entry count plus terminator for the simple menu; for the
+// full menu also a newline, every entry, the "B) BASIC" line and the terminator
+static size_t menu_block_size(const std::vector<CompressedPFile>& files, bool simple) {
+    if (files.size() < 2) return 0;
+    if (simple) return 2;
+    size_t size = 2 + 1 + 8 + 1;
+    for (size_t i = 0; i < files.size(); i++) size += menu_entry_size(i, files[i].original_name);
+    return size;
+}
+
+// The decoder for a ROM: the one asked for, or with Auto the fastest one whose
+// loader still leaves room for the menu and payload. Custom loaders are taken to
+// carry dzx7_standard.
+static Decoder choose_decoder(const RomSpec& spec, ByteView loader, const std::vector<CompressedPFile>& files) {
+    if (custom_loader(spec, loader)) return Decoder::Standard;
+    if (spec.decoder != Decoder::Auto) return spec.decoder;
+
+    size_t needed = menu_block_size(files, spec.simple_menu) + (spec.sysvar_dict ? sysvar_primer_size() : 0);
+    for (const auto& pfile : files) needed += pfile.compressed_data.size();
+    for (Decoder decoder : {Decoder::Mega, Decoder::Turbo}) {
+        const EmbeddedLoader& l = embedded_loader(decoder);
+        if ((files.size() > 1 ? l.menu_len : l.single_len) + needed <= 8192) return decoder;
+    }
+    return Decoder::Standard;
+}
+
+// Bank packing and selection budget with the smallest loader Auto may fall back to
+static Decoder capacity_decoder(const RomSpec& spec) {
+    return spec.decoder == Decoder::Auto ? Decoder::Standard : spec.decoder;
+}
+
+// A laid out 16K image and the numbers behind it
+struct RomImage {
+    std::vector<uint8_t> rom;
+    size_t stub_size = 0;
+    size_t filename_block_size = 0;
+    size_t total_compressed_size = 0;
+    Decoder decoder = Decoder::Standard;
+    std::vector<BuildStats::Patch> patches;  // menu loader LD HL,nn pointed at the payloads
+
+    size_t used_upper() const { return stub_size + filename_block_size + total_compressed_size; }
+};
+
+// Places loader, filename block and payloads in the upper 8K and patches the
+// menu loader with the payload offsets. The image is built in place at into,
+// e.g. a bank of an EPROM image, or else in the returned RomImage::rom.
+static RomImage layout_rom(const RomSpec& spec, ByteView base, const std::vector<uint8_t>& stub,
+                           std::vector<CompressedPFile>& compressed_files, std::ostream& log, BuildStats& stats,
+                           uint8_t* into = nullptr) {
+    BuildStats::Stage layout_timing(stats, "layout", spec.output);
+    const bool use_menu = (compressed_files.size() > 1);
+    const bool use_simple_menu = spec.simple_menu;
+    const bool force_loader = spec.force_loader;
+
+    RomImage image;
+    image.stub_size = stub.size();
+    for (const auto& pfile : compressed_files) image.total_compressed_size += pfile.compressed_data.size();
+    size_t total_compressed_size = image.total_compressed_size;
+
+    // Check if everything fits (including filename block)
+    size_t filename_block_size = use_menu ? menu_block_size(compressed_files, use_simple_menu) : 0;
+    image.filename_block_size = filename_block_size;
+    
+    size_t available_space = 8192 - stub.size();
+    size_t total_needed = filename_block_size + total_compressed_size;
+    
+    if (total_needed > available_space) {
+        throw std::runtime_error("Filename block (" + std::to_string(filename_block_size) + 
+                               " bytes) + compressed P-files (" + std::to_string(total_compressed_size) + 
+                               " bytes) don't fit in available space (" + std::to_string(available_space) + " bytes)");
+    }
+
+    // Build 16K ROM
+    const size_t rom_size = 16384;
+    if (!into) {
+        image.rom.resize(rom_size);
+        into = image.rom.data();
+    }
+    uint8_t* const rom = into;
+
+    // Lower 8K: base ROM
+    std::copy(base.begin(), base.end(), rom);
+    std::fill(rom + base.size(), rom + rom_size, 0x00);
+
+    // Upper 8K: loader + filenames + P-files
+    const size_t loader_off = 0x2000;
+    size_t cursor = loader_off;
+    
+    // Copy loader
+    std::copy(stub.begin(), stub.end(), rom + cursor);
+    cursor += stub.size();
+
+    // Add filename block (only for multi-file mode)
+    size_t filename_block_start = cursor;
+    if (use_menu && compressed_files.size() > 1) {
+        
+
+    	if(use_simple_menu){
+    		 log << "[info] Writing simple menu\n";	
+    		 rom[cursor++] =  ascii_to_zx81( std::to_string(compressed_files.size())[0] );
+    		 rom[cursor++] = 0x09;            
+    	} 
+    	else 
+    	{
+        	rom[cursor++] =  ascii_to_zx81( std::to_string(compressed_files.size())[0] );
+        	rom[cursor++] = 0x76;
+            log << "[info] Writing filename block at offset 0x" << std::hex << cursor << std::dec << "\n";
+        
+            for (size_t i = 0; i < compressed_files.size(); i++) {
+       	     std::string filename_entry = std::to_string(i + 1) + ") " + compressed_files[i].original_name;
+            
+        	    // Uppercase
+//				std::transform(filename_entry.begin(), filename_entry.end(), filename_entry.begin(), [](unsigned char c) { return std::toupper(c); });
+
+    	        rom[cursor++] = 0x76;	//Start by adding a new line
+	            // Write each character as a byte
+                for (char c : filename_entry) {
+    	            if (cursor >= rom_size) {
+	                    throw std::runtime_error("Filename block exceeds ROM size");
+                    }
+                
+        	        c = std::toupper(static_cast<unsigned char>(c));
+				    rom[cursor++] = ascii_to_zx81(c);
+	            }
+                rom[cursor++] = 0x76;	//New line
+            	log << "[info]   Entry " << (i + 1) << ": \"" << filename_entry << "\" (" << filename_entry.length() << " bytes)\n";
+        	}
+
+            //Write BASIC option to end of list
+            std::string basic_entry = "B) BASIC";
+            rom[cursor++] = 0x76;
+            for (char c : basic_entry) {
+                if (cursor >= rom_size) {
+                    throw std::runtime_error("Filename block exceeds ROM size");
+                }
+            
+                c = std::toupper(static_cast<unsigned char>(c));
+                rom[cursor++] = ascii_to_zx81(c);
+            }
+            
+            
+            rom[cursor++] = 0x09; // Add String terminator
+	        size_t filename_block_size = cursor - filename_block_start;
+            log << "[info] Filename block: " << filename_block_size << " bytes total\n";
+        }
+    }
+
+    // Store P-files and track their offsets
+    for (auto& pfile : compressed_files) {
+        pfile.offset = cursor;
+        std::copy(pfile.compressed_data.begin(), pfile.compressed_data.end(), rom + cursor);
+        cursor += pfile.compressed_data.size();
+        
+        log << "[info] " << pfile.original_name << " stored at offset 0x" 
+            << std::hex << pfile.offset << std::dec << "\n";
+    }
+
+    layout_timing.finish();
+
+    // Patch menu loader with actual P-file offsets (only for multi-file mode)
+    if (use_menu && compressed_files.size() > 1) {
+        BuildStats::Stage timing(stats, "patch", spec.output);
+        log << "[info] Patching menu loader with P-file offsets...\n";
+        if(force_loader)
+            log << "[warning] Custom loader forced. This might end bad...\n";
+        
+        size_t search_start = loader_off;
+        size_t search_end = loader_off + stub.size();
+        size_t patches_made = 0;
+        
+        for (size_t i = search_start; i <= search_end - 3 && patches_made < compressed_files.size(); i++) {
+            // Look for pattern: 21 00 20 (LD HL, $2000)
+            if (rom[i] == 0x21 && rom[i+1] == 0x00 && rom[i+2] == 0x20) {
+                uint16_t offset = static_cast<uint16_t>(compressed_files[patches_made].offset);
+                uint8_t low_byte = offset & 0xFF;
+                uint8_t high_byte = (offset >> 8) & 0xFF;
+                
+                rom[i+1] = low_byte;
+                rom[i+2] = high_byte;
+                image.patches.push_back({ i, offset, compressed_files[patches_made].original_name });
+                
+                log << "[info]   Patch " << patches_made << ": 0x" << std::hex << (i - loader_off) 
+                    << " -> LD HL,$" << std::hex << offset << std::dec 
+                    << " (" << compressed_files[patches_made].original_name << ")\n";
+                
+                patches_made++;
+            }
+        }
+        
+        if (patches_made != compressed_files.size()) {
+            log << "[warning] Expected " << compressed_files.size() 
+                << " patches but made " << patches_made << "\n";
+        }
+    }
+
+    return image;
+}
+
+// Decodes a payload back out of a finished 16K image, at the offset the layout
+// recorded, and compares it with its P-file. ZX7 inputs have no P-file to
+// compare with; they only have to decode within their stored bytes and fit in
+// RAM. Through the sysvar primer a payload is decoded after the template and
+// kept up to its E_LINE.
+static void verify_payload(const uint8_t* rom, const CompressedPFile& pfile) {
+    const ByteView source = pfile.source;
+    std::vector<uint8_t> decoded;
+    try {
+        if (pfile.sysvar_dict) {
+            decoded = dzx7_decode(rom + pfile.offset, pfile.compressed_data.size(),
+                                  !source.empty() ? source.size() : MAX_PROGRAM - SYSVARS_SIZE, nullptr, sysvar_template());
+            size_t loaded = sysvar_program_size(decoded);
+            if (loaded < SYSVARS_SIZE || loaded > decoded.size()) {
+                throw std::runtime_error("E_LINE is outside the " + std::to_string(decoded.size()) + " decoded bytes");
+            }
+            decoded.resize(loaded);
+        } else {
+            decoded = dzx7_decode(rom + pfile.offset, pfile.compressed_data.size(),
+                                  !source.empty() ? source.size() : MAX_PROGRAM);
+        }
+    } catch (const std::exception& e) {
+        std::ostringstream what;
+        what << "Verify: " << pfile.original_name << " at offset 0x" << std::hex << pfile.offset << ": " << e.what();
+        throw std::runtime_error(what.str());
+    }
+    if (!source.empty() && ByteView(decoded) != source) {
+        size_t at = std::mismatch(decoded.begin(), decoded.end(), source.begin(), source.end()).first - decoded.begin();
+        throw std::runtime_error("Verify: " + pfile.original_name + " decodes to " + std::to_string(decoded.size())
+                                 + " bytes that differ from its P-file (" + std::to_string(source.size())
+                                 + " bytes) at byte " + std::to_string(at));
+    }
+}
+
+// Multi-bank EPROM images. Every 16K bank is a complete image with its own copy
+// of the base ROM, and a menu when it holds more than one program.
+const size_t MAX_MENU_ENTRIES = 9;  // the menu loader reacts to keys 1-9
+
+struct EpromImage {
+    std::vector<uint8_t> image;
+    std::vector<std::vector<size_t>> banks;  // program indices per bank, in input order
+    std::vector<RomImage> layouts;
+};
+
+// Spreads programs over as few banks as possible with first-fit decreasing. A
+// program costs its payload plus its menu line; one that only fits next to the
+// smaller single-file loader gets a bank of its own.
+static std::vector<std::vector<size_t>> pack_banks(const std::vector<CompressedPFile>& files,
+                                                   size_t single_stub, size_t menu_stub, bool simple) {
+    const size_t single_capacity = 8192 - std::min<size_t>(single_stub, 8192);
+    const size_t menu_fixed = simple ? 2 : 12;
+    const size_t menu_capacity = 8192 - std::min<size_t>(menu_stub + menu_fixed, 8192);
+
+    std::vector<size_t> cost(files.size());
+    std::vector<size_t> order(files.size());
+    for (size_t i = 0; i < files.size(); i++) {
+        cost[i] = files[i].compressed_data.size() + (simple ? 0 : menu_entry_size(0, files[i].original_name));
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return cost[a] > cost[b]; });
+
+    std::vector<std::vector<size_t>> banks;
+    std::vector<size_t> room;
+    for (size_t i : order) {
+        if (cost[i] > menu_capacity) {
+            if (files[i].compressed_data.size() > single_capacity) {
+                throw std::runtime_error(files[i].original_name + " (" + std::to_string(files[i].compressed_data.size())
+                                         + " bytes) doesn't fit in a bank (" + std::to_string(single_capacity) + " bytes)");
+            }
+            banks.push_back({i});
+            room.push_back(0);
+            continue;
+        }
+        size_t b = 0;
+        while (b < banks.size() && (room[b] < cost[i] || banks[b].size() >= MAX_MENU_ENTRIES)) b++;
+        if (b == banks.size()) {
+            banks.emplace_back();
+            room.push_back(menu_capacity);
+        }
+        banks[b].push_back(i);
+        room[b] -= cost[i];
+    }
+
+    for (auto& bank : banks) std::sort(bank.begin(), bank.end());
+    std::sort(banks.begin(), banks.end());
+    return banks;
+}
+
+static EpromImage layout_eprom(const RomSpec& spec, ByteView base, ByteView loader,
+                               std::vector<CompressedPFile>& files, std::ostream& log, BuildStats& stats) {
+    RomSpec single = spec, menu = spec;
+    single.inputs.resize(1);
+    menu.inputs.resize(2);
+    std::ostream quiet(nullptr);
+    const std::vector<uint8_t> single_stub = load_stub(single, loader, capacity_decoder(spec), quiet);
+    const std::vector<uint8_t> menu_stub = load_stub(menu, loader, capacity_decoder(spec), quiet);
+
+    EpromImage eprom;
+    {
+        BuildStats::Stage timing(stats, "pack", spec.output);
+        eprom.banks = pack_banks(files, single_stub.size(), menu_stub.size(), spec.simple_menu);
+    }
+    if (eprom.banks.size() > spec.eprom_banks) {
+        throw std::runtime_error("Programs need " + std::to_string(eprom.banks.size()) + " banks but the EPROM has "
+                                 + std::to_string(spec.eprom_banks));
+    }
+
+    // Unused banks keep the erased state of the EPROM
+    eprom.image.assign(spec.eprom_banks * BANK_SIZE, 0xFF);
+    for (size_t b = 0; b < eprom.banks.size(); b++) {
+        RomSpec bank_spec = spec;
+        bank_spec.inputs.clear();
+        std::vector<CompressedPFile> bank_files;
+        for (size_t i : eprom.banks[b]) {
+            bank_spec.inputs.push_back(spec.inputs[i]);
+            bank_files.push_back(files[i]);
+        }
+
+        // Packed for the smallest loader; a faster one is used where the bank has room
+        const Decoder decoder = choose_decoder(bank_spec, loader, bank_files);
+        RomImage image = layout_rom(spec, base, load_stub(bank_spec, loader, decoder, quiet), bank_files, quiet, stats,
+                                    eprom.image.data() + b * BANK_SIZE);
+        image.decoder = decoder;
+        for (size_t k = 0; k < bank_files.size(); k++) files[eprom.banks[b][k]].offset = bank_files[k].offset;
+
+        log << "[info] Bank " << b << ": " << bank_files.size() << (bank_files.size() > 1 ? " programs (menu)" : " program")
+            << ", used " << image.used_upper() << " / 8192 bytes, dzx7_" << decoder_name(decoder) << "\n";
+        eprom.layouts.push_back(std::move(image));
+    }
+    return eprom;
+}
+
+static void verify_eprom(const EpromImage& eprom, const std::vector<CompressedPFile>& files) {
+    for (size_t b = 0; b < eprom.banks.size(); b++) {
+        for (size_t i : eprom.banks[b]) verify_payload(eprom.image.data() + b * BANK_SIZE, files[i]);
+    }
+}
+
+// Picks the most valuable set of programs that fits one 16K image: an exact 0/1
+// knapsack over the menu budget (payload plus menu line per program, at most
+// 9 programs), compared with the best single program next to the smaller
+// single-file loader. Reports what was left out and by how much.
+static std::vector<size_t> select_programs(const RomSpec& spec, ByteView loader,
+                                           const std::vector<CompressedPFile>& files, std::ostream& log) {
+    RomSpec single = spec, menu = spec;
+    single.inputs.resize(1);
+    menu.inputs.resize(2);
+    std::ostream quiet(nullptr);
+    const size_t single_stub = load_stub(single, loader, capacity_decoder(spec), quiet).size();
+    const size_t menu_stub = load_stub(menu, loader, capacity_decoder(spec), quiet).size();
+    const size_t menu_fixed = spec.simple_menu ? 2 : 12;
+    const size_t single_capacity = 8192 - std::min<size_t>(single_stub, 8192);
+    const size_t menu_capacity = 8192 - std::min<size_t>(menu_stub + menu_fixed, 8192);
+
+    auto priority = [&](size_t i) { return i < spec.priorities.size() ? spec.priorities[i] : uint64_t(1); };
+
+    std::vector<size_t> cost(files.size());
+    std::vector<uint64_t> value(files.size());
+    for (size_t i = 0; i < files.size(); i++) {
+        cost[i] = files[i].compressed_data.size() + (spec.simple_menu ? 0 : menu_entry_size(0, files[i].original_name));
+        value[i] = priority(i);
+    }
+    std::vector<size_t> chosen = knapsack_select(cost, value, menu_capacity, MAX_MENU_ENTRIES);
+    size_t capacity = menu_capacity;
+
+    uint64_t chosen_value = 0;
+    for (size_t i : chosen) chosen_value += value[i];
+    for (size_t i = 0; i < files.size(); i++) {
+        if (files[i].compressed_data.size() <= single_capacity && value[i] > chosen_value) {
+            chosen = {i};
+            chosen_value = value[i];
+            capacity = single_capacity;
+        }
+    }
+    if (chosen.size() == 1) {
+        capacity = single_capacity;
+        for (size_t i = 0; i < files.size(); i++) cost[i] = files[i].compressed_data.size();
+    }
+    if (chosen.empty()) throw std::runtime_error("None of the P-files fits in the upper 8K");
+
+    size_t used = 0;
+    for (size_t i : chosen) used += cost[i];
+    log << "[info] Selected " << chosen.size() << " of " << files.size() << " programs (priority "
+        << chosen_value << ", " << used << " of " << capacity << " bytes)\n";
+    for (size_t i = 0, k = 0; i < files.size(); i++) {
+        if (k < chosen.size() && chosen[k] == i) { k++; continue; }
+        log << "[info]   Left out " << files[i].original_name << " (priority " << value[i] << ", "
+            << cost[i] << " bytes, " << (cost[i] > capacity - used ? cost[i] - (capacity - used) : 0)
+            << " bytes short)\n";
+    }
+    return chosen;
+}
+
+static CompressedPFile to_pfile(const SourceFile& src, bool sysvar_dict) {
+    CompressedPFile pfile;
+    pfile.original_name = program_name(src.path);
+    pfile.compressed_data = src.stream;
+    pfile.raw_size = src.raw_size;
+    pfile.from_cache = src.from_cache;
+    pfile.offset = 0;
+    pfile.source = src.zx7 ? ByteView() : src.raw;
+    pfile.sysvar_dict = sysvar_dict;
+    return pfile;
+}
+
+static void log_verified(size_t files, std::chrono::steady_clock::time_point start, std::ostream& log) {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    log << "[info] Verified " << files << " payload(s) against their inputs in " << us << " us\n";
+}
+
+// Sizes of every input, for --stats
+static void record_sources(const std::vector<SourceFile>& sources, BuildStats& stats) {
+    if (!stats.enabled()) return;
+    for (const auto& src : sources) {
+        BuildStats::FileStats file;
+        file.path = src.path;
+        file.raw = src.raw_size;
+        file.compressed = src.stream.size();
+        file.zx7 = src.zx7;
+        file.from_cache = src.from_cache;
+        file.shared = src.duplicate;
+        file.split = src.split;
+        stats.add_file(file);
+    }
+}
+
+// Wraps the inputs as sources; with --compact, P-files are trimmed before
+// anything else sees them
+static std::vector<SourceFile> prepare_sources(const std::vector<std::string>& names,
+                                               const std::vector<ByteView>& inputs, const EncoderOptions& options,
+                                               BuildStats& stats) {
+    std::vector<SourceFile> sources(names.size());
+    for (size_t i = 0; i < names.size(); i++) {
+        sources[i].path = names[i];
+        sources[i].zx7 = is_zx7(names[i]);
+        sources[i].raw = inputs[i];
+        if (!options.compact || sources[i].zx7) continue;
+        BuildStats::Stage timing(stats, "compact", names[i]);
+        try {
+            sources[i].edited = sources[i].raw.to_vector();
+            sources[i].trimmed = compact_pfile(sources[i].edited);
+            sources[i].raw = sources[i].edited;
+        } catch (const std::exception& e) {
+            throw std::runtime_error(names[i] + ": " + e.what() + " (--compact)");
+        }
+    }
+    return sources;
+}
+
+// The [info] lines for the inputs of a single build
+static void log_sources(const std::vector<SourceFile>& sources, const std::vector<CompressedPFile>& files,
+                        const CompressStats& stats, const EncoderOptions& options, std::ostream& log) {
+    for (size_t i = 0; i < sources.size(); i++) {
+        const SourceFile& src = sources[i];
+        log_compression(files[i], src.from_cache, log);
+        if (src.trimmed) log << "[info]   compacted: " << src.trimmed << " bytes after E_LINE trimmed\n";
+        if (src.unsplit_size) {
+            long diff = (long)src.stream.size() - (long)src.unsplit_size;
+            log << "[info]   split parse: " << src.stream.size() << " bytes, in one piece "
+                << src.unsplit_size << " (" << (diff >= 0 ? "+" : "") << diff << " bytes, "
+                << std::fixed << std::setprecision(2) << (diff >= 0 ? "+" : "")
+                << 100.0 * diff / src.unsplit_size << "%)\n" << std::defaultfloat;
+        }
+    }
+    if (stats.workers) {
+        log << "[info] Compressor workspace: " << stats.workers << " worker(s), peak "
+            << stats.peak_bytes << " bytes\n";
+    }
+    if (options.profile) log_profiles(sources, log);
+}
+
+static ProgramReport program_report(const CompressedPFile& pfile, size_t bank, Decoder decoder) {
+    ProgramReport program;
+    program.name = pfile.original_name;
+    program.bank = bank;
+    program.offset = pfile.offset;
+    program.compressed = pfile.compressed_data.size();
+    program.raw = pfile.raw_size;
+    program.from_cache = pfile.from_cache;
+    program.decode_tstates = decode_tstates(pfile.compressed_data, decoder);
+    return program;
+}
+
+static BankReport bank_report(const RomImage& image, bool custom, std::vector<size_t> programs) {
+    BankReport bank;
+    bank.decoder = image.decoder;
+    bank.custom_loader = custom;
+    bank.loader = image.stub_size;
+    bank.menu = image.filename_block_size;
+    bank.payload = image.total_compressed_size;
+    bank.programs = std::move(programs);
+    bank.patches = image.patches;
+    return bank;
+}
+
+// Layout of an image, or of each bank of an EPROM image, for --stats
+static std::vector<BuildStats::RomStats> rom_stats(const std::string& output, const RomReport& report) {
+    std::vector<BuildStats::RomStats> roms;
+    for (size_t b = 0; b < report.banks.size(); b++) {
+        const BankReport& bank = report.banks[b];
+        BuildStats::RomStats rom;
+        rom.output = output;
+        rom.bank = report.eprom_banks ? (int)b : -1;
+        rom.decoder = decoder_name(bank.decoder);
+        rom.loader = bank.loader;
+        rom.menu = bank.menu;
+        rom.payload = bank.payload;
+        rom.used = bank.used();
+        rom.free = 8192 - rom.used;
+        for (size_t i : bank.programs) {
+            const ProgramReport& p = report.programs[i];
+            rom.programs.push_back({ p.name, p.offset, p.compressed });
+        }
+        rom.patches = bank.patches;
+        roms.push_back(rom);
+    }
+    return roms;
+}
+
+// Lays out one ROM from its compressed programs: a 16K image, or with
+// spec.eprom_banks the programs spread over the banks of an EPROM
+static RomResult assemble(const RomSpec& spec, ByteView base, ByteView loader, std::vector<CompressedPFile>& files,
+                          bool verify, std::ostream& log, BuildStats& stats) {
+    RomResult result;
+    RomReport& report = result.report;
+    report.eprom_banks = spec.eprom_banks;
+
+    if (spec.eprom_banks) {
+        EpromImage eprom = layout_eprom(spec, base, loader, files, log, stats);
+        if (verify) {
+            BuildStats::Stage timing(stats, "verify", spec.output);
+            auto start = std::chrono::steady_clock::now();
+            verify_eprom(eprom, files);
+            log_verified(files.size(), start, log);
+        }
+        report.programs.resize(files.size());
+        for (size_t b = 0; b < eprom.banks.size(); b++) {
+            const RomImage& image = eprom.layouts[b];
+            for (size_t i : eprom.banks[b]) report.programs[i] = program_report(files[i], b, image.decoder);
+            RomSpec bank_spec = spec;
+            bank_spec.inputs.resize(eprom.banks[b].size());
+            report.banks.push_back(bank_report(image, custom_loader(bank_spec, loader), eprom.banks[b]));
+        }
+        result.image = std::move(eprom.image);
+        return result;
+    }
+
+    const Decoder decoder = choose_decoder(spec, loader, files);
+    std::vector<uint8_t> stub;
+    {
+        BuildStats::Stage timing(stats, "load", spec.output);
+        stub = load_stub(spec, loader, decoder, log);
+    }
+    RomImage image = layout_rom(spec, base, stub, files, log, stats);
+    image.decoder = decoder;
+    if (verify) {
+        BuildStats::Stage timing(stats, "verify", spec.output);
+        auto start = std::chrono::steady_clock::now();
+        for (const auto& pfile : files) verify_payload(image.rom.data(), pfile);
+        log_verified(files.size(), start, log);
+    }
+    std::vector<size_t> programs;
+    for (size_t i = 0; i < files.size(); i++) {
+        report.programs.push_back(program_report(files[i], 0, decoder));
+        programs.push_back(i);
+    }
+    report.banks.push_back(bank_report(image, custom_loader(spec, loader), std::move(programs)));
+    result.image = std::move(image.rom);
+    return result;
+}
+
+static ByteView checked_base(ByteView base) {
+    if (base.empty()) base = load_embedded_base();
+    if (base.size() != 8192) throw std::runtime_error("Base ROM must be exactly 8K");
+    return base;
+}
+
+RomBuilder::RomBuilder(const EncoderOptions& options, unsigned jobs)
+    : options_(options), jobs_(std::max(1u, jobs)) {
+}
+
+RomResult RomBuilder::build(const RomSpec& spec, const std::vector<ByteView>& inputs,
+                            ByteView base, ByteView loader) const {
+    std::ostream quiet(nullptr);  // per call: a shared sink's format flags would race
+    std::ostream& log = log_ ? *log_ : quiet;
+    BuildStats& stats = stats_ ? *stats_ : no_stats;
+    if (inputs.size() != spec.inputs.size()) throw std::runtime_error("Expected one input per P-file of the ROM");
+    base = checked_base(base);
+
+    std::vector<SourceFile> sources = prepare_sources(spec.inputs, inputs, options_, stats);
+    CompressStats workspace = compress_sources(sources, options_, jobs_, cache_ ? *cache_ : no_cache, stats);
+    record_sources(sources, stats);
+    std::vector<CompressedPFile> files;
+    for (const auto& src : sources) files.push_back(to_pfile(src, options_.sysvar_dict));
+    log_sources(sources, files, workspace, options_, log);
+
+    // Selection: continue with the best subset as if only it had been given
+    RomSpec selected = spec;
+    if (spec.select) {
+        BuildStats::Stage timing(stats, "select", spec.output);
+        std::vector<size_t> chosen = select_programs(spec, loader, files, log);
+        selected.inputs.clear();
+        std::vector<CompressedPFile> kept;
+        for (size_t i : chosen) {
+            selected.inputs.push_back(spec.inputs[i]);
+            kept.push_back(files[i]);
+        }
+        files = std::move(kept);
+    }
+
+    RomResult result = assemble(selected, base, loader, files, verify_, log, stats);
+    if (stats.enabled()) {
+        for (const auto& rom : rom_stats(spec.output, result.report)) stats.add_rom(rom);
+    }
+    return result;
+}
+
+BatchReport RomBuilder::build_all(const std::vector<RomSpec>& roms, const Files& files, const RomDone& done) const {
+    std::ostream quiet(nullptr);  // per call: a shared sink's format flags would race
+    std::ostream& log = log_ ? *log_ : quiet;
+    BuildStats& stats = stats_ ? *stats_ : no_stats;
+
+    std::vector<std::string> paths;
+    std::map<std::string, size_t> path_index;
+    for (const auto& spec : roms) {
+        for (const auto& in : spec.inputs) {
+            if (path_index.emplace(in, paths.size()).second) paths.push_back(in);
+        }
+    }
+    std::vector<ByteView> inputs;
+    for (const auto& path : paths) {
+        BuildStats::Stage timing(stats, "read", path);
+        inputs.push_back(files(path));
+    }
+
+    std::vector<SourceFile> sources = prepare_sources(paths, inputs, options_, stats);
+    CompressStats workspace = compress_sources(sources, options_, jobs_, cache_ ? *cache_ : no_cache, stats);
+    record_sources(sources, stats);
+
+    BatchReport batch;
+    batch.roms.resize(roms.size());
+    batch.errors.resize(roms.size());
+    std::vector<std::vector<BuildStats::RomStats>> rom_rows(roms.size());
+    parallel_for(roms.size(), jobs_, [&](size_t r, unsigned) {
+        const RomSpec& spec = roms[r];
+        try {
+            ByteView base, loader;
+            {
+                BuildStats::Stage timing(stats, "load", spec.output);
+                base = checked_base(spec.base_path.empty() ? ByteView() : files(spec.base_path));
+                if (!spec.loader_path.empty() && (spec.inputs.size() == 1 || spec.force_loader)) {
+                    loader = files(spec.loader_path);
+                }
+            }
+            std::vector<CompressedPFile> pfiles;
+            for (const auto& in : spec.inputs) pfiles.push_back(to_pfile(sources[path_index[in]], options_.sysvar_dict));
+            // Each task logs to a sink of its own: layout sets std::hex on it,
+            // which on a shared stream would race between workers
+            std::ostream quiet(nullptr);
+            RomResult result = assemble(spec, base, loader, pfiles, verify_, quiet, stats);
+            if (stats.enabled()) rom_rows[r] = rom_stats(spec.output, result.report);
+            if (done) done(r, result);
+            batch.roms[r] = std::move(result.report);
+        } catch (const std::exception& e) {
+            batch.errors[r] = e.what();
+            rom_rows[r].assign(1, BuildStats::RomStats());
+            rom_rows[r][0].output = spec.output;
+            rom_rows[r][0].error = batch.errors[r];
+        }
+    });
+    for (const auto& rows : rom_rows) {
+        for (const auto& rom : rows) stats.add_rom(rom);
+    }
+
+    batch.inputs = paths.size();
+    for (const auto& src : sources) {
+        if (src.duplicate) batch.shared++;
+        else if (src.from_cache) batch.cached++;
+        else if (!src.zx7) batch.compressed++;
+    }
+    batch.workers = workspace.workers;
+    batch.peak_bytes = workspace.peak_bytes;
+    if (options_.profile) log_profiles(sources, log);
+    return batch;
+}
+
+// Extraction: finds the programs in an image p2rom built by recognising the
+// embedded loader at $2000 of each 16K bank, and decodes them back to P-files
+
+static char zx81_to_ascii(uint8_t code) {
+    for (int c = ' '; c <= 'Z'; c++) {
+        if (ascii_to_zx81((char)c) == code) return (char)c;
+    }
+    return '?';
+}
+
+// The stub matches an embedded loader, ignoring the operands of LD HL,$2000
+// that the layout patches in a menu loader
+static bool matches_loader(const uint8_t* rom, const unsigned char* loader, size_t len, bool menu) {
+    for (size_t i = 0; i < len; i++) {
+        if (menu && i + 2 < len && loader[i] == 0x21 && loader[i+1] == 0x00 && loader[i+2] == 0x20) {
+            if (rom[0x2000 + i] != 0x21) return false;
+            i += 2;
+        } else if (rom[0x2000 + i] != loader[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+RecoveredBank recover_bank(const uint8_t* rom) {
+    RecoveredBank bank;
+    for (Decoder d : {Decoder::Standard, Decoder::Turbo, Decoder::Mega}) {
+        for (bool primed : {false, true}) {
+            std::vector<uint8_t> single = load_embedded_loader(d).to_vector();
+            std::vector<uint8_t> menu = load_embedded_menuloader(d).to_vector();
+            if (primed) {
+                add_sysvar_primer(single, false);
+                add_sysvar_primer(menu, true);
+            }
+            bank.decoder = d;
+            bank.sysvar_dict = primed;
+            // Single-file loader: LD HL,payload / LD DE,$4009 / ...
+            if (rom[0x2000] == 0x21 && std::equal(single.begin() + 3, single.end(), rom + 0x2003)) {
+                bank.programs.push_back(FoundProgram{"", (size_t)(rom[0x2001] | rom[0x2002] << 8)});
+                return bank;
+            }
+            if (!matches_loader(rom, menu.data(), menu.size(), true)) continue;
+
+            // Menu loader: the count digit, then "\n" and the entries for the full
+            // menu or the terminator for the simple one
+            size_t pos = 0x2000 + menu.size();
+            const int count = rom[pos] - ascii_to_zx81('0');
+            if (count < 2 || count > (int)MAX_MENU_ENTRIES) throw std::runtime_error("menu block lists no programs");
+            const bool full = rom[pos + 1] == 0x76;
+            bank.simple_menu = !full;
+            pos += 2;
+
+            std::vector<FoundProgram>& programs = bank.programs;
+            for (size_t i = 0; i + 2 < menu.size() && (int)programs.size() < count; i++) {
+                if (menu[i] != 0x21 || menu[i+1] != 0x00 || menu[i+2] != 0x20) continue;
+                FoundProgram p;
+                p.offset = rom[0x2000 + i + 1] | rom[0x2000 + i + 2] << 8;
+                if (full) {
+                    // "\n" "n) NAME" "\n"
+                    std::string line;
+                    for (pos++; pos < BANK_SIZE && rom[pos] != 0x76; pos++) line += zx81_to_ascii(rom[pos]);
+                    pos++;
+                    auto paren = line.find(") ");
+                    if (paren != std::string::npos) p.name = line.substr(paren + 2);
+                }
+                programs.push_back(p);
+                i += 2;
+            }
+            return bank;
+        }
+    }
+    throw std::runtime_error("no p2rom loader at $2000");
+}
+
+std::vector<uint8_t> decode_program(const uint8_t* rom, const RecoveredBank& bank, size_t offset, size_t& stream) {
+    if (offset < 0x2000 || offset >= BANK_SIZE) throw std::runtime_error("payload outside the upper 8K");
+    std::vector<uint8_t> program;
+    if (bank.sysvar_dict) {
+        program = dzx7_decode(rom + offset, BANK_SIZE - offset, MAX_PROGRAM - SYSVARS_SIZE, &stream,
+                              sysvar_template());
+        program.resize(std::min(program.size(), sysvar_program_size(program)));
+    } else {
+        program = dzx7_decode(rom + offset, BANK_SIZE - offset, MAX_PROGRAM, &stream);
+    }
+    return program;
+}
+
+// A program of an image by its menu number (1-9) or its name, in any case
+static size_t find_entry(const std::vector<CompressedPFile>& files, const std::string& entry) {
+    if (!entry.empty() && entry.find_first_not_of("0123456789") == std::string::npos) {
+        size_t n = std::strtoul(entry.c_str(), nullptr, 10);
+        if (n >= 1 && n <= files.size()) return n - 1;
+    }
+    for (size_t i = 0; i < files.size(); i++) {
+        const std::string& name = files[i].original_name;
+        if (name.size() == entry.size()
+            && std::equal(name.begin(), name.end(), entry.begin(), [](char a, char b) {
+                   return std::toupper((unsigned char)a) == std::toupper((unsigned char)b);
+               })) {
+            return i;
+        }
+    }
+    throw std::runtime_error("no program '" + entry + "' in the image");
+}
+
+// The layout is recovered from the loader, and each payload is delimited by
+// decoding it. The image is then laid out again as a build of the same
+// programs would be: the other payloads are copied from the old image
+// unchanged and the loader is patched with their new offsets.
+RomResult RomBuilder::update(ByteView image, const RomSpec& rom_spec, const RomEdit& edit, ByteView base) const {
+    std::ostream quiet(nullptr);  // per call: a shared sink's format flags would race
+    std::ostream& log = log_ ? *log_ : quiet;
+    BuildStats& stats = stats_ ? *stats_ : no_stats;
+    if (image.size() != BANK_SIZE) throw std::runtime_error("not a 16K ROM image (EPROM images are not updated)");
+    const RecoveredBank bank = recover_bank(image.data());
+
+    // The payloads only decode the way they were compressed: through the
+    // sysvar primer or not
+    RomSpec spec = rom_spec;
+    EncoderOptions options = options_;
+    if (spec.sysvar_dict && !bank.sysvar_dict) {
+        throw std::runtime_error("the programs in the image were not compressed with --sysvar-dict");
+    }
+    options.sysvar_dict = spec.sysvar_dict = bank.sysvar_dict;
+    spec.simple_menu = spec.simple_menu || bank.simple_menu;
+    spec.force_loader = false;
+    spec.eprom_banks = 0;
+    spec.select = false;
+
+    std::vector<CompressedPFile> files;
+    for (size_t k = 0; k < bank.programs.size(); k++) {
+        const FoundProgram& p = bank.programs[k];
+        size_t stream = 0;
+        std::vector<uint8_t> program;
+        try {
+            program = decode_program(image.data(), bank, p.offset, stream);
+        } catch (const std::exception& e) {
+            throw std::runtime_error("program " + std::to_string(k + 1) + ": " + e.what());
+        }
+        CompressedPFile pfile;
+        pfile.original_name = !p.name.empty() ? p.name : program_name(spec.output);
+        pfile.compressed_data = ByteView(image.data() + p.offset, stream);
+        pfile.offset = p.offset;
+        pfile.raw_size = program.size();
+        pfile.sysvar_dict = bank.sysvar_dict;
+        files.push_back(pfile);
+    }
+    log << "[info] Image: " << (files.size() > 1 ? "menu" : "single-file") << " loader (dzx7_"
+        << decoder_name(bank.decoder) << "), " << files.size() << " program(s)\n";
+
+    std::vector<SourceFile> sources;
+    if (edit.kind != RomEdit::Remove) {
+        sources = prepare_sources({edit.name}, {edit.input}, options, stats);
+        compress_sources(sources, options, 1, cache_ ? *cache_ : no_cache, stats);
+    }
+    switch (edit.kind) {
+        case RomEdit::Add:
+            files.push_back(to_pfile(sources[0], options.sysvar_dict));
+            log_compression(files.back(), sources[0].from_cache, log);
+            log << "[info] Added " << files.back().original_name << " as program " << files.size() << "\n";
+            break;
+        case RomEdit::Replace: {
+            size_t i = find_entry(files, edit.entry);
+            std::string name = files[i].original_name;
+            files[i] = to_pfile(sources[0], options.sysvar_dict);
+            log_compression(files[i], sources[0].from_cache, log);
+            log << "[info] Replaced program " << (i + 1) << " (" << name << ") with " << files[i].original_name << "\n";
+            break;
+        }
+        case RomEdit::Remove: {
+            size_t i = find_entry(files, edit.entry);
+            if (files.size() == 1) throw std::runtime_error("can't remove the only program of the image");
+            log << "[info] Removed program " << (i + 1) << " (" << files[i].original_name << ")\n";
+            files.erase(files.begin() + (std::ptrdiff_t)i);
+            break;
+        }
+    }
+    if (files.size() > MAX_MENU_ENTRIES) {
+        throw std::runtime_error("a menu holds at most " + std::to_string(MAX_MENU_ENTRIES) + " programs");
+    }
+
+    spec.inputs.clear();
+    for (const auto& pfile : files) spec.inputs.push_back(pfile.original_name);
+    return assemble(spec, checked_base(base.empty() ? ByteView(image.data(), 8192) : base), ByteView(), files,
+                    verify_, log, stats);
+}
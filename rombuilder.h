@@ -0,0 +1,160 @@
+// rombuilder.h - libp2rom: ZX81 ROM and EPROM images built from P-files held in memory
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "bytes.h"
+#include "cache.h"
+#include "manifest.h"
+#include "stats.h"
+
+extern "C" {
+    #include "zx7/zx7.h"
+}
+
+// How P-files get compressed
+struct EncoderOptions {
+    int parse = ZX7_PARSE_OPTIMAL;      // -0 greedy, -1 lazy, -2 optimal
+    int match_finder = ZX7_MATCH_HASH;  // same output either way, only speed differs
+    size_t split = 0;                   // parse inputs larger than this in segments of this size
+    uint32_t speed = 0;                 // optimal parse: bits per dzx7 T-state, times ZX7_SPEED_ONE
+    bool split_report = false;          // also compress split inputs in one piece, to compare
+    bool profile = false;               // report the compressor's counters (make PROFILE=1)
+    bool sysvar_dict = false;           // compress P-files against the sysvar template
+    bool compact = false;               // trim P-files at E_LINE
+};
+
+// One program of a finished image
+struct ProgramReport {
+    std::string name;             // the menu entry
+    size_t bank = 0;              // 16K bank of an EPROM image, else 0
+    size_t offset = 0;            // address of the payload in its bank
+    size_t compressed = 0;
+    size_t raw = 0;               // 0 for ZX7 inputs
+    bool from_cache = false;
+    uint64_t decode_tstates = 0;  // for the decoder of its bank
+};
+
+// One 16K image, or one bank of an EPROM image
+struct BankReport {
+    Decoder decoder = Decoder::Standard;
+    bool custom_loader = false;
+    size_t loader = 0;           // bytes of loader, including the sysvar primer
+    size_t menu = 0;             // filename block
+    size_t payload = 0;
+    std::vector<size_t> programs;            // indices into RomReport::programs, in menu order
+    std::vector<BuildStats::Patch> patches;  // menu loader LD HL,nn pointed at the payloads
+
+    size_t used() const { return loader + menu + payload; }
+};
+
+struct RomReport {
+    size_t eprom_banks = 0;                // 0 for a 16K image
+    std::vector<ProgramReport> programs;   // what the image holds, in input order
+    std::vector<BankReport> banks;         // one for a 16K image; used banks of an EPROM
+};
+
+struct RomResult {
+    std::vector<uint8_t> image;  // 16K, or the whole EPROM
+    RomReport report;
+};
+
+// Every ROM of a RomBuilder::build_all()
+struct BatchReport {
+    std::vector<RomReport> roms;
+    std::vector<std::string> errors;  // per ROM: why it failed, empty if it was built
+    size_t inputs = 0;                // distinct input names
+    size_t compressed = 0;            // compressed in this build
+    size_t cached = 0;                // found in the compression cache
+    size_t shared = 0;                // same contents as another input
+    size_t workers = 0;               // compressor workspaces and their peak size
+    size_t peak_bytes = 0;
+};
+
+// One change to the programs of an image (RomBuilder::update)
+struct RomEdit {
+    enum Kind { Add, Remove, Replace } kind = Add;
+    std::string entry;  // Remove, Replace: menu number or name of the program
+    std::string name;   // Add, Replace: file name of the new program (".zx7" for a ZX7 stream)
+    ByteView input;     // Add, Replace: its bytes
+};
+
+// Builds images without touching the console or the file system: inputs come
+// in as bytes, images and what went into them come back, and errors are thrown
+// as std::runtime_error. A builder can be used from several threads at once.
+class RomBuilder {
+public:
+    // The bytes of a file named in a RomSpec (an input, base_path or
+    // loader_path); may be called from several threads at once, and the bytes
+    // have to stay valid until the build returns
+    using Files = std::function<ByteView(const std::string& name)>;
+    // Hands over each image of build_all() as soon as it is laid out, on a worker
+    // thread; an exception thrown here fails that ROM
+    using RomDone = std::function<void(size_t rom, RomResult& result)>;
+
+    explicit RomBuilder(const EncoderOptions& options = EncoderOptions(), unsigned jobs = 1);
+
+    // Reuses compressed streams across builds (none by default); the cache has to outlive the builder
+    void set_cache(const CompressionCache* cache) { cache_ = cache; }
+    // Receives the [info] lines of each build as it goes (nothing by default)
+    void set_log(std::ostream* log) { log_ = log; }
+    // Records stage timings and layouts (nothing by default)
+    void set_stats(BuildStats* stats) { stats_ = stats; }
+    // Decodes every payload from the finished image and compares it with its input
+    void set_verify(bool verify) { verify_ = verify; }
+
+    // One image. inputs holds the bytes of spec.inputs in the same order; the
+    // names give the menu entries, and ".zx7" marks a stream that is already
+    // compressed. base and loader stay empty for the embedded ones.
+    RomResult build(const RomSpec& spec, const std::vector<ByteView>& inputs,
+                    ByteView base = ByteView(), ByteView loader = ByteView()) const;
+
+    // Every ROM of a manifest: each distinct input is compressed once and the
+    // images are laid out in parallel. A ROM that fails is reported in
+    // BatchReport::errors and the others go on.
+    BatchReport build_all(const std::vector<RomSpec>& roms, const Files& files, const RomDone& done) const;
+
+    // Adds, removes or replaces one program of a 16K image p2rom built; only the
+    // new program is compressed. Menu style and --sysvar-dict are taken from
+    // the image. base stays empty to keep the image's own.
+    RomResult update(ByteView image, const RomSpec& spec, const RomEdit& edit, ByteView base = ByteView()) const;
+
+private:
+    EncoderOptions options_;
+    unsigned jobs_;
+    const CompressionCache* cache_ = nullptr;
+    std::ostream* log_ = nullptr;
+    BuildStats* stats_ = nullptr;
+    bool verify_ = false;
+};
+
+// Reading images back: the programs in one 16K bank, found by recognising the
+// embedded loader at $2000
+struct FoundProgram {
+    std::string name;   // from the menu, empty if the ROM does not record it
+    size_t offset;      // of the payload in its 16K bank
+};
+
+struct RecoveredBank {
+    Decoder decoder = Decoder::Standard;
+    bool sysvar_dict = false;  // the loader carries the sysvar primer
+    bool simple_menu = false;
+    std::vector<FoundProgram> programs;  // in menu order
+};
+
+const size_t BANK_SIZE = 16384;
+
+// Throws std::runtime_error if no embedded loader is found
+RecoveredBank recover_bank(const uint8_t* rom);
+
+// Decodes the program at offset of a recovered bank back to its P-file;
+// stream is set to the length of its compressed payload
+std::vector<uint8_t> decode_program(const uint8_t* rom, const RecoveredBank& bank, size_t offset, size_t& stream);
+
+// The menu name of an input: its file name without directory and extension
+std::string program_name(const std::string& path);
@@ -0,0 +1,27 @@
+// sha256.h - small self-contained SHA-256, used to key cached compression results
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class Sha256 {
+public:
+    using Digest = std::array<uint8_t, 32>;
+
+    Sha256();
+    void update(const void* data, size_t len);
+    void update(const std::string& s) { update(s.data(), s.size()); }
+    Digest finish();
+
+    static std::string hex(const Digest& d);
+
+private:
+    void block(const uint8_t* p);
+
+    uint32_t state_[8];
+    uint8_t  buf_[64];
+    size_t   buf_len_ = 0;
+    uint64_t total_ = 0;
+};
@@ -0,0 +1,203 @@
+// stats.cpp - per-stage timings and build numbers, as a table, JSON or a Chrome trace
+#include "stats.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+
+#include <time.h>
+
+namespace {
+
+int64_t cpu_us(clockid_t clock) {
+    timespec ts;
+    if (clock_gettime(clock, &ts) != 0) return 0;
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+std::string json_string(const std::string& s) {
+    std::string out = "\"";
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += (char)c;
+        } else if (c < 0x20) {
+            char esc[8];
+            std::snprintf(esc, sizeof esc, "\\u%04x", c);
+            out += esc;
+        } else {
+            out += (char)c;
+        }
+    }
+    return out + "\"";
+}
+
+struct Total {
+    size_t count = 0;
+    int64_t wall_us = 0;
+    int64_t cpu_us = 0;
+};
+
+// "name": {"count": n, "wall_us": w, "cpu_us": c} for each stage, in order of first use
+void write_stage_totals(std::ostream& out, const std::vector<std::pair<std::string, Total>>& totals,
+                        const char* indent) {
+    out << "{";
+    for (size_t i = 0; i < totals.size(); i++) {
+        const Total& t = totals[i].second;
+        out << (i ? ",\n" : "\n") << indent << "  " << json_string(totals[i].first) << ": {\"count\": " << t.count
+            << ", \"wall_us\": " << t.wall_us << ", \"cpu_us\": " << t.cpu_us << "}";
+    }
+    out << (totals.empty() ? "}" : "\n" + std::string(indent) + "}");
+}
+
+} // namespace
+
+BuildStats::BuildStats()
+    : start_(std::chrono::steady_clock::now()), cpu_start_us_(cpu_us(CLOCK_PROCESS_CPUTIME_ID)) {
+    threads_.emplace(std::this_thread::get_id(), 0);
+}
+
+int64_t BuildStats::now_us() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_).count();
+}
+
+BuildStats::Stage::Stage(BuildStats& stats, const char* name, const std::string& subject)
+    : stats_(stats.enabled() ? &stats : nullptr), name_(name) {
+    if (!stats_) return;
+    subject_ = subject;
+    start_us_ = stats_->now_us();
+    cpu_start_us_ = cpu_us(CLOCK_THREAD_CPUTIME_ID);
+}
+
+BuildStats::Stage::~Stage() {
+    finish();
+}
+
+void BuildStats::Stage::finish() {
+    if (!stats_) return;
+    const int64_t cpu = cpu_us(CLOCK_THREAD_CPUTIME_ID) - cpu_start_us_;
+    stats_->add_span({ name_, std::move(subject_), 0, start_us_, stats_->now_us() - start_us_, cpu });
+    stats_ = nullptr;
+}
+
+void BuildStats::add_span(Span span) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    span.thread = threads_.emplace(std::this_thread::get_id(), (unsigned)threads_.size()).first->second;
+    spans_.push_back(std::move(span));
+}
+
+void BuildStats::add_file(const FileStats& file) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    files_.push_back(file);
+}
+
+void BuildStats::add_rom(const RomStats& rom) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    roms_.push_back(rom);
+}
+
+namespace {
+
+// Totals per stage over the spans whose subject passes keep, in order of first use
+template <typename Spans, typename Keep>
+std::vector<std::pair<std::string, Total>> stage_totals(const Spans& spans, Keep keep) {
+    std::vector<std::pair<std::string, Total>> totals;
+    for (const auto& span : spans) {
+        if (!keep(span.subject)) continue;
+        size_t i = 0;
+        while (i < totals.size() && totals[i].first != span.name) i++;
+        if (i == totals.size()) totals.emplace_back(span.name, Total());
+        totals[i].second.count++;
+        totals[i].second.wall_us += span.wall_us;
+        totals[i].second.cpu_us += span.cpu_us;
+    }
+    return totals;
+}
+
+} // namespace
+
+void BuildStats::write_text(std::ostream& out) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto totals = stage_totals(spans_, [](const std::string&) { return true; });
+    out << "\nStage          Runs    Wall ms     CPU ms\n" << std::fixed << std::setprecision(3);
+    for (const auto& t : totals) {
+        out << std::left << std::setw(12) << t.first << std::right << std::setw(7) << t.second.count
+            << std::setw(11) << t.second.wall_us / 1000.0 << std::setw(11) << t.second.cpu_us / 1000.0 << "\n";
+    }
+    out << std::left << std::setw(19) << "elapsed" << std::right << std::setw(11) << now_us() / 1000.0
+        << std::setw(11) << (cpu_us(CLOCK_PROCESS_CPUTIME_ID) - cpu_start_us_) / 1000.0 << "\n" << std::defaultfloat;
+    out << "(Stage times are summed over threads)\n";
+}
+
+void BuildStats::write_json(std::ostream& out) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    out << "{\n  \"version\": 1,\n  \"wall_us\": " << now_us() << ",\n  \"cpu_us\": "
+        << cpu_us(CLOCK_PROCESS_CPUTIME_ID) - cpu_start_us_ << ",\n  \"threads\": " << threads_.size() << ",\n  \"stages\": ";
+    write_stage_totals(out, stage_totals(spans_, [](const std::string&) { return true; }), "  ");
+
+    out << ",\n  \"files\": [";
+    for (size_t i = 0; i < files_.size(); i++) {
+        const FileStats& f = files_[i];
+        out << (i ? ",\n" : "\n") << "    {\"path\": " << json_string(f.path) << ", \"raw\": " << f.raw
+            << ", \"compressed\": " << f.compressed << ", \"zx7\": " << (f.zx7 ? "true" : "false")
+            << ", \"cached\": " << (f.from_cache ? "true" : "false") << ", \"shared\": " << (f.shared ? "true" : "false")
+            << ", \"split\": " << (f.split ? "true" : "false") << ",\n     \"stages\": ";
+        write_stage_totals(out, stage_totals(spans_, [&](const std::string& s) { return s == f.path; }), "     ");
+        out << "}";
+    }
+    out << (files_.empty() ? "]" : "\n  ]");
+
+    out << ",\n  \"roms\": [";
+    for (size_t i = 0; i < roms_.size(); i++) {
+        const RomStats& r = roms_[i];
+        out << (i ? ",\n" : "\n") << "    {\"output\": " << json_string(r.output);
+        if (r.bank >= 0) out << ", \"bank\": " << r.bank;
+        if (!r.error.empty()) {
+            out << ", \"error\": " << json_string(r.error) << "}";
+            continue;
+        }
+        out << ", \"decoder\": " << json_string(r.decoder) << ", \"loader\": " << r.loader
+            << ", \"menu\": " << r.menu << ", \"payload\": " << r.payload << ", \"used\": " << r.used
+            << ", \"free\": " << r.free << ",\n     \"programs\": [";
+        for (size_t k = 0; k < r.programs.size(); k++) {
+            const Program& p = r.programs[k];
+            out << (k ? ", " : "") << "{\"name\": " << json_string(p.name) << ", \"offset\": " << p.offset
+                << ", \"size\": " << p.size << "}";
+        }
+        out << "],\n     \"patches\": [";
+        for (size_t k = 0; k < r.patches.size(); k++) {
+            const Patch& p = r.patches[k];
+            out << (k ? ", " : "") << "{\"at\": " << p.at << ", \"value\": " << p.value
+                << ", \"program\": " << json_string(p.program) << "}";
+        }
+        out << "]";
+        // Bank entries share the stages of their image, which are listed once with bank 0
+        if (r.bank <= 0) {
+            out << ",\n     \"stages\": ";
+            write_stage_totals(out, stage_totals(spans_, [&](const std::string& s) { return s == r.output; }), "     ");
+        }
+        out << "}";
+    }
+    out << (roms_.empty() ? "]" : "\n  ]") << "\n}\n";
+}
+
+void BuildStats::write_trace(const std::string& path) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::ofstream out(path);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    for (const auto& thread : threads_) {
+        out << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << thread.second
+            << ", \"args\": {\"name\": " << json_string(thread.second ? "worker " + std::to_string(thread.second) : "main")
+            << "}}";
+        first = false;
+    }
+    for (const Span& span : spans_) {
+        out << ",\n{\"name\": " << json_string(span.name) << ", \"cat\": \"p2rom\", \"ph\": \"X\", \"pid\": 1, \"tid\": "
+            << span.thread << ", \"ts\": " << span.start_us << ", \"dur\": " << span.wall_us
+            << ", \"args\": {\"subject\": " << json_string(span.subject) << ", \"cpu_us\": " << span.cpu_us << "}}";
+    }
+    out << "\n]}\n";
+    if (!out) throw std::runtime_error("Could not write trace " + path);
+}
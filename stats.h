@@ -0,0 +1,111 @@
+// stats.h - per-stage timings and build numbers, as a table, JSON or a Chrome trace
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+class BuildStats {
+public:
+    BuildStats();
+
+    // Nothing is recorded until enabled; a disabled stage costs one branch
+    void enable() { enabled_ = true; }
+    bool enabled() const { return enabled_; }
+
+    // Times its own lifetime, wall clock and CPU of the calling thread, as one
+    // run of the named stage for subject (an input path or an output ROM).
+    // Safe to use from several threads at once.
+    class Stage {
+    public:
+        Stage(BuildStats& stats, const char* name, const std::string& subject = "");
+        ~Stage();
+        // Ends the stage before the end of its scope
+        void finish();
+        Stage(const Stage&) = delete;
+        Stage& operator=(const Stage&) = delete;
+
+    private:
+        BuildStats* stats_;  // null when disabled
+        const char* name_;
+        std::string subject_;
+        int64_t start_us_ = 0;
+        int64_t cpu_start_us_ = 0;
+    };
+
+    struct FileStats {
+        std::string path;
+        size_t raw = 0;          // 0 for ZX7 inputs
+        size_t compressed = 0;
+        bool zx7 = false;
+        bool from_cache = false;
+        bool shared = false;     // same contents as an earlier input
+        bool split = false;
+    };
+
+    struct Program {
+        std::string name;
+        size_t offset = 0;       // address of the payload
+        size_t size = 0;
+    };
+
+    // An LD HL,nn in the menu loader pointed at a payload
+    struct Patch {
+        size_t at = 0;           // address of the LD
+        uint16_t value = 0;
+        std::string program;
+    };
+
+    // One 16K image, or one bank of an EPROM image
+    struct RomStats {
+        std::string output;
+        int bank = -1;           // -1 for a plain 16K image
+        std::string decoder;
+        size_t loader = 0;
+        size_t menu = 0;
+        size_t payload = 0;
+        size_t used = 0;
+        size_t free = 0;
+        std::vector<Program> programs;
+        std::vector<Patch> patches;
+        std::string error;
+    };
+
+    void add_file(const FileStats& file);
+    void add_rom(const RomStats& rom);
+
+    // Stage totals, as a table for the log
+    void write_text(std::ostream& out) const;
+    // Everything, with the stage times per input file and per ROM
+    void write_json(std::ostream& out) const;
+    // Every stage run as a complete event on its thread, for chrome://tracing or Perfetto
+    void write_trace(const std::string& path) const;
+
+private:
+    struct Span {
+        const char* name;
+        std::string subject;
+        unsigned thread;
+        int64_t start_us;
+        int64_t wall_us;
+        int64_t cpu_us;
+    };
+
+    int64_t now_us() const;
+    void add_span(Span span);
+
+    bool enabled_ = false;
+    std::chrono::steady_clock::time_point start_;
+    int64_t cpu_start_us_;                         // process CPU time at start_
+    mutable std::mutex mutex_;
+    std::map<std::thread::id, unsigned> threads_;  // the constructing thread is 0
+    std::vector<Span> spans_;
+    std::vector<FileStats> files_;
+    std::vector<RomStats> roms_;
+};
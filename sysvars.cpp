@@ -0,0 +1,193 @@
+// sysvars.cpp - the sysvar dictionary: a canonical system variable block the loader puts in RAM first
+#include "sysvars.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+
+extern "C" {
+    #include "zx7/zx7.h"
+}
+
+namespace {
+
+const uint16_t VERSN = 0x4009;
+const uint16_t E_LINE = 0x4014;
+
+uint16_t word(ByteView data, size_t at) {
+    return (uint16_t)(data[at] | data[at + 1] << 8);
+}
+
+// Stores a little-endian word, as in Z80 operands
+void put_word(std::vector<uint8_t>& data, size_t at, uint16_t value) {
+    data[at] = (uint8_t)value;
+    data[at + 1] = (uint8_t)(value >> 8);
+}
+
+// Offset of the first occurrence of pattern in stub, or npos
+size_t find(const std::vector<uint8_t>& stub, std::initializer_list<uint8_t> pattern) {
+    auto it = std::search(stub.begin(), stub.end(), pattern.begin(), pattern.end());
+    return it == stub.end() ? std::string::npos : (size_t)(it - stub.begin());
+}
+
+// The template as a ZX7 stream, compressed once
+const std::vector<uint8_t>& template_zx7() {
+    static const std::vector<uint8_t> stream = [] {
+        std::unique_ptr<ZX7Context, decltype(&zx7_destroy)> ctx(zx7_create(), &zx7_destroy);
+        const std::vector<uint8_t>& t = sysvar_template();
+        unsigned char* out = nullptr;
+        size_t size = 0;
+        long delta = 0;
+        if (!ctx || zx7_compress(ctx.get(), t.data(), t.size(), 0, &out, &size, &delta) != ZX7_OK) {
+            throw std::runtime_error("ZX7 compress failed: sysvar template");
+        }
+        return std::vector<uint8_t>(out, out + size);
+    }();
+    return stream;
+}
+
+// The primer at address at, calling the decoder at dzx7. Entered with HL at
+// the program's stream in place of dzx7 (asm/sysvars.asm):
+//
+//         push hl / ld hl,TEMPLATE / ld de,$4009 / call dzx7
+//         pop hl / ld de,$407D / call dzx7
+//         ld hl,($4014+116) / ld bc,-$4009 / add hl,bc / ld b,h / ld c,l
+//         ld hl,$407D / ld de,$4009 / ldir / ret
+// TEMPLATE:
+const size_t PRIMER_CODE = 35;
+
+std::vector<uint8_t> primer(uint16_t at, uint16_t dzx7) {
+    std::vector<uint8_t> code = {
+        0xE5,                   // push hl
+        0x21, 0x00, 0x00,       // ld   hl,TEMPLATE
+        0x11, 0x09, 0x40,       // ld   de,$4009
+        0xCD, 0x00, 0x00,       // call dzx7         template to $4009-$407C
+        0xE1,                   // pop  hl
+        0x11, 0x7D, 0x40,       // ld   de,$407D
+        0xCD, 0x00, 0x00,       // call dzx7         program after it, matching into it
+        0x2A, 0x00, 0x00,       // ld   hl,(nn)      the program's E_LINE
+        0x01, 0x00, 0x00,       // ld   bc,-$4009
+        0x09,                   // add  hl,bc
+        0x44,                   // ld   b,h
+        0x4D,                   // ld   c,l          its length
+        0x21, 0x7D, 0x40,       // ld   hl,$407D
+        0x11, 0x09, 0x40,       // ld   de,$4009
+        0xED, 0xB0,             // ldir              down over the template
+        0xC9,                   // ret
+    };
+    put_word(code, 2, (uint16_t)(at + PRIMER_CODE));
+    put_word(code, 8, dzx7);
+    put_word(code, 15, dzx7);
+    put_word(code, 18, (uint16_t)(E_LINE + SYSVARS_SIZE));
+    put_word(code, 21, (uint16_t)-VERSN);
+    const std::vector<uint8_t>& t = template_zx7();
+    code.insert(code.end(), t.begin(), t.end());
+    return code;
+}
+
+} // namespace
+
+const std::vector<uint8_t>& sysvar_template() {
+    static const std::vector<uint8_t> block = {
+        0x00,                   // VERSN
+        0x00, 0x00,             // E_PPC
+        0x7D, 0x40,             // D_FILE  $407D
+        0x7E, 0x40,             // DF_CC
+        0x96, 0x43,             // VARS    after a full 793-byte display
+        0x00, 0x00,             // DEST
+        0x97, 0x43,             // E_LINE
+        0x99, 0x43,             // CH_ADD
+        0x00, 0x00,             // X_PTR
+        0x9C, 0x43,             // STKBOT
+        0x9C, 0x43,             // STKEND
+        0x00,                   // BERG
+        0x5D, 0x40,             // MEM     MEMBOT
+        0x00,                   // (unused)
+        0x02,                   // DF_SZ
+        0x00, 0x00,             // S_TOP
+        0xFF, 0xFF,             // LAST_K
+        0xFF,                   // DB_ST
+        0x37,                   // MARGIN  50 Hz
+        0x00, 0x00,             // NXTLIN
+        0x00, 0x00,             // OLDPPC
+        0x00,                   // FLAGX
+        0x00, 0x00,             // STRLEN
+        0x8D, 0x0C,             // T_ADDR
+        0x00, 0x00,             // SEED
+        0xFF, 0xFF,             // FRAMES
+        0x00, 0x00,             // COORDS
+        0xBC,                   // PR_CC
+        0x21, 0x18,             // S_POSN
+        0x40,                   // CDFLAG
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,   // PRBUFF
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x76,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,   // MEMBOT
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00,             // (spare)
+    };
+    return block;
+}
+
+std::vector<uint8_t> with_sysvar_template(ByteView pfile) {
+    std::vector<uint8_t> input;
+    input.reserve(SYSVARS_SIZE + pfile.size());
+    input.insert(input.end(), sysvar_template().begin(), sysvar_template().end());
+    input.insert(input.end(), pfile.begin(), pfile.end());
+    return input;
+}
+
+size_t sysvar_program_size(ByteView pfile) {
+    if (pfile.size() < SYSVARS_SIZE) return 0;
+    uint16_t e_line = word(pfile, E_LINE - VERSN);
+    return e_line > VERSN ? (size_t)(e_line - VERSN) : 0;
+}
+
+std::string sysvar_check(ByteView pfile, size_t max_program) {
+    if (pfile.size() < SYSVARS_SIZE) return "shorter than the system variables";
+    size_t size = sysvar_program_size(pfile);
+    if (size != pfile.size()) {
+        char e_line[8];
+        std::snprintf(e_line, sizeof e_line, "$%04X", word(pfile, E_LINE - VERSN));
+        return "E_LINE (" + std::string(e_line) + ") ends it at " + std::to_string(size) + " bytes, not at its "
+               + std::to_string(pfile.size());
+    }
+    if (size + SYSVARS_SIZE > max_program) {
+        return std::to_string(size) + " bytes don't fit in RAM after the template";
+    }
+    return "";
+}
+
+bool add_sysvar_primer(std::vector<uint8_t>& stub, bool menu) {
+    // The loader calls dzx7 after LD DE,$4009
+    size_t call = find(stub, {0x11, 0x09, 0x40, 0xCD});
+    if (call == std::string::npos) return false;
+
+    // The single-file loader starts LD HL,payload with the payload right after
+    // it; the menu loader CALL CLS / LD BC,MENU with the prompt at its end
+    size_t at;
+    if (menu) {
+        if (stub.size() < 6 || stub[0] != 0xCD || stub[3] != 0x01) return false;
+        at = word(stub, 4) - 0x2000;
+        if (at > stub.size()) return false;
+    } else {
+        if (stub[0] != 0x21) return false;
+        at = stub.size();
+    }
+
+    std::vector<uint8_t> code = primer((uint16_t)(0x2000 + at), word(stub, call + 4));
+    put_word(stub, call + 4, (uint16_t)(0x2000 + at));
+    stub.insert(stub.begin() + at, code.begin(), code.end());
+    if (menu) put_word(stub, 4, (uint16_t)(word(stub, 4) + code.size()));
+    else put_word(stub, 1, (uint16_t)(0x2000 + stub.size()));
+    return true;
+}
+
+size_t sysvar_primer_size() {
+    return PRIMER_CODE + template_zx7().size();
+}
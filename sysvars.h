@@ -0,0 +1,36 @@
+// sysvars.h - the sysvar dictionary: a canonical system variable block the loader puts in RAM first
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "bytes.h"
+
+// A P-file starts with the system variables from VERSN ($4009) up to the
+// display file ($407D)
+const size_t SYSVARS_SIZE = 116;
+
+// The block of a 16K ZX81 with an empty program, as SAVE writes it
+const std::vector<uint8_t>& sysvar_template();
+
+// The template followed by the P-file: what the encoder is given, with the
+// first SYSVARS_SIZE bytes as a dictionary that is skipped in the output
+std::vector<uint8_t> with_sysvar_template(ByteView pfile);
+
+// Length of the program the primer leaves in RAM: the bytes up to its E_LINE,
+// as LOAD reads them
+size_t sysvar_program_size(ByteView pfile);
+
+// Why a P-file can't go through the primer, or empty
+std::string sysvar_check(ByteView pfile, size_t max_program);
+
+// Adds the primer to an embedded loader: the routine and the compressed
+// template go after the single-file loader or before the menu prompt, and the
+// loader's CALL dzx7 is pointed at it. Returns false for a loader it doesn't
+// recognise.
+bool add_sysvar_primer(std::vector<uint8_t>& stub, bool menu);
+
+// Bytes the primer adds to a loader
+size_t sysvar_primer_size();
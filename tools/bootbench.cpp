@@ -0,0 +1,105 @@
+// bootbench.cpp - boots p2rom images on an emulated ZX81 and reports where the
+// T-states go between reset and the jump into the program
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+
+#include "zx81.h"
+
+static const double CLOCK_HZ = 3250000.0;
+
+static std::vector<uint8_t> slurp(const std::string& path) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f) { throw std::runtime_error("Cannot open: " + path); }
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(f)),
+                               std::istreambuf_iterator<char>());
+    return data;
+}
+
+static void report(const std::string& path, const BootResult& boot) {
+    std::printf("%s: %llu T-states (%.3f s) from reset to JP $%04X\n", path.c_str(),
+                (unsigned long long)boot.tstates, boot.tstates / CLOCK_HZ, boot.exit);
+    std::printf("  %-18s %6s %12s %7s\n", "phase", "calls", "T-states", "share");
+    for (const BootPhase& p : boot.phases) {
+        char name[32];
+        if (p.entry) std::snprintf(name, sizeof name, "%s ($%04X)", p.name.empty() ? "call" : p.name.c_str(), p.entry);
+        else std::snprintf(name, sizeof name, "%s", p.name.c_str());
+        std::string calls = p.entry ? std::to_string(p.calls) : "-";
+        std::printf("  %-18s %6s %12llu %6.1f%%", name, calls.c_str(), (unsigned long long)p.tstates,
+                    boot.tstates ? 100.0 * p.tstates / boot.tstates : 0.0);
+        if (p.bytes) std::printf("  %llu bytes, %.1f T/byte", (unsigned long long)p.bytes, (double)p.tstates / p.bytes);
+        std::printf("\n");
+    }
+}
+
+int main(int argc, char** argv) {
+    char key = '1';
+    size_t bank = 0;
+    uint64_t limit = 100000000;
+
+    static const option long_opts[] = {
+        {"key",   required_argument, nullptr, 'k'},
+        {"bank",  required_argument, nullptr, 'b'},
+        {"limit", required_argument, nullptr, 't'},
+        {"help",  no_argument,       nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "k:b:t:h", long_opts, nullptr)) != -1) {
+        switch (opt) {
+            case 'k':
+                key = (char)std::toupper((unsigned char)optarg[0]);
+                if (std::strlen(optarg) != 1 || !ZX81::has_key(key)) {
+                    std::cerr << "Error: invalid key '" << optarg << "'\n";
+                    return 1;
+                }
+                break;
+            case 'b': bank = std::strtoul(optarg, nullptr, 10); break;
+            case 't': limit = std::strtoull(optarg, nullptr, 10); break;
+            case 'h':
+            default:
+                std::cerr <<
+                  "Usage: " << argv[0] << " [-k key] [-b bank] [-t limit] <image.rom> [...]\n"
+                  "  -k, --key KEY     Key held down from reset, for menus (default 1; B drops to BASIC)\n"
+                  "  -b, --bank N      16K bank of an EPROM image to boot (default 0)\n"
+                  "  -t, --limit N     Give up after N T-states (default 100000000)\n"
+                  "  Boots each image on a ZX81 with 16K RAM until the loader jumps to $0676 or $0F2B\n"
+                  "  and reports the T-states spent in each phase, at 3.25 MHz.\n";
+                return (opt=='h') ? 0 : 1;
+        }
+    }
+    if (optind >= argc) {
+        std::cerr << "Error: no ROM image specified\n";
+        return 1;
+    }
+
+    int status = 0;
+    for (int i = optind; i < argc; i++) {
+        try {
+            std::vector<uint8_t> image = slurp(argv[i]);
+            if (image.size() < (bank + 1) * ZX81::ROM_SIZE) {
+                throw std::runtime_error(std::string(argv[i]) + " has no 16K bank " + std::to_string(bank));
+            }
+            BootResult boot = boot_rom(image.data() + bank * ZX81::ROM_SIZE, key, limit);
+            if (!boot.finished) {
+                throw std::runtime_error(std::string(argv[i]) + ": loader did not finish within "
+                                         + std::to_string(limit) + " T-states");
+            }
+            report(argv[i], boot);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            status = 2;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,612 @@
+// z80.cpp - small Z80 core with exact instruction timings, for boot benchmarks
+//
+// Every instruction is executed whole and charged its documented T-states,
+// including the undocumented IXH/IXL/IYH/IYL forms and SLL. Memory contention
+// and the position of the bus cycles inside an instruction are not modelled;
+// nothing on a ZX81 needs them.
+#include "z80.h"
+
+namespace {
+
+enum : uint8_t { FC = 0x01, FN = 0x02, FP = 0x04, FX = 0x08, FH = 0x10, FY = 0x20, FZ = 0x40, FS = 0x80 };
+
+inline uint8_t sz53(uint8_t v) { return (uint8_t)((v & (FS | FY | FX)) | (v ? 0 : FZ)); }
+inline uint8_t parity(uint8_t v) { return __builtin_parity(v) ? 0 : FP; }
+inline uint8_t sz53p(uint8_t v) { return (uint8_t)(sz53(v) | parity(v)); }
+
+}  // namespace
+
+void Z80::reset() {
+    a = f = 0xFF;
+    sp = 0xFFFF;
+    pc = 0;
+    i = 0;
+    im = 0;
+    r_ = r7_ = 0;
+    iff1 = iff2 = false;
+    halted = false;
+    ei_delay_ = false;
+    prefix_ = 0;
+    t = 0;
+}
+
+uint8_t& Z80::reg(int code) {
+    switch (code) {
+        case 0: return b;
+        case 1: return c;
+        case 2: return d;
+        case 3: return e;
+        case 4: return h;
+        case 5: return l;
+        default: return a;
+    }
+}
+
+uint8_t Z80::get_x(int code) {
+    if (prefix_ && code == 4) return (uint8_t)(hl_x() >> 8);
+    if (prefix_ && code == 5) return (uint8_t)hl_x();
+    return reg(code);
+}
+
+void Z80::set_x(int code, uint8_t v) {
+    if (prefix_ && code == 4) set_hl_x((uint16_t)(v << 8 | (hl_x() & 0xFF)));
+    else if (prefix_ && code == 5) set_hl_x((uint16_t)((hl_x() & 0xFF00) | v));
+    else reg(code) = v;
+}
+
+uint16_t Z80::rp(int code) {
+    switch (code) {
+        case 0: return bc();
+        case 1: return de();
+        case 2: return hl_x();
+        default: return sp;
+    }
+}
+
+void Z80::set_rp(int code, uint16_t v) {
+    switch (code) {
+        case 0: b = (uint8_t)(v >> 8); c = (uint8_t)v; break;
+        case 1: d = (uint8_t)(v >> 8); e = (uint8_t)v; break;
+        case 2: set_hl_x(v); break;
+        default: sp = v; break;
+    }
+}
+
+uint16_t Z80::rp2(int code) {
+    return code == 3 ? (uint16_t)(a << 8 | f) : rp(code);
+}
+
+void Z80::set_rp2(int code, uint16_t v) {
+    if (code == 3) { a = (uint8_t)(v >> 8); f = (uint8_t)v; }
+    else set_rp(code, v);
+}
+
+void Z80::set_hl_x(uint16_t v) {
+    if (prefix_ == 0xDD) ix = v;
+    else if (prefix_ == 0xFD) iy = v;
+    else { h = (uint8_t)(v >> 8); l = (uint8_t)v; }
+}
+
+bool Z80::cond(int code) const {
+    switch (code) {
+        case 0: return !(f & FZ);
+        case 1: return f & FZ;
+        case 2: return !(f & FC);
+        case 3: return f & FC;
+        case 4: return !(f & FP);
+        case 5: return f & FP;
+        case 6: return !(f & FS);
+        default: return f & FS;
+    }
+}
+
+void Z80::alu(int op, uint8_t v) {
+    unsigned r;
+    uint8_t carry = f & FC;
+    switch (op) {
+        case 0:  // ADD
+        case 1:  // ADC
+            r = a + v + (op == 1 ? carry : 0);
+            f = (uint8_t)(sz53((uint8_t)r) | ((a ^ v ^ r) & FH) |
+                          (((a ^ ~v) & (a ^ r) & 0x80) ? FP : 0) | ((r >> 8) & FC));
+            a = (uint8_t)r;
+            break;
+        case 2:  // SUB
+        case 3:  // SBC
+        case 7:  // CP
+            r = a - v - (op == 3 ? carry : 0);
+            f = (uint8_t)((sz53((uint8_t)r) & ~(FY | FX)) | FN | ((a ^ v ^ r) & FH) |
+                          (((a ^ v) & (a ^ r) & 0x80) ? FP : 0) | ((r >> 8) & FC));
+            // CP takes the undocumented bits from the operand, the others from the result
+            f |= (op == 7 ? v : (uint8_t)r) & (FY | FX);
+            if (op != 7) a = (uint8_t)r;
+            break;
+        case 4: a &= v; f = sz53p(a) | FH; break;
+        case 5: a ^= v; f = sz53p(a); break;
+        default: a |= v; f = sz53p(a); break;
+    }
+}
+
+uint8_t Z80::inc8(uint8_t v) {
+    uint8_t r = (uint8_t)(v + 1);
+    f = (uint8_t)((f & FC) | sz53(r) | ((v & 0x0F) == 0x0F ? FH : 0) | (v == 0x7F ? FP : 0));
+    return r;
+}
+
+uint8_t Z80::dec8(uint8_t v) {
+    uint8_t r = (uint8_t)(v - 1);
+    f = (uint8_t)((f & FC) | sz53(r) | FN | ((v & 0x0F) == 0 ? FH : 0) | (v == 0x80 ? FP : 0));
+    return r;
+}
+
+// RLC RRC RL RR SLA SRA SLL SRL, as in the CB page
+uint8_t Z80::rot(int op, uint8_t v) {
+    uint8_t r, carry;
+    switch (op) {
+        case 0: carry = v >> 7; r = (uint8_t)(v << 1 | carry); break;
+        case 1: carry = v & 1;  r = (uint8_t)(v >> 1 | carry << 7); break;
+        case 2: carry = v >> 7; r = (uint8_t)(v << 1 | (f & FC)); break;
+        case 3: carry = v & 1;  r = (uint8_t)(v >> 1 | (f & FC) << 7); break;
+        case 4: carry = v >> 7; r = (uint8_t)(v << 1); break;
+        case 5: carry = v & 1;  r = (uint8_t)((v >> 1) | (v & 0x80)); break;
+        case 6: carry = v >> 7; r = (uint8_t)(v << 1 | 1); break;
+        default: carry = v & 1; r = (uint8_t)(v >> 1); break;
+    }
+    f = (uint8_t)(sz53p(r) | carry);
+    return r;
+}
+
+uint16_t Z80::add16(uint16_t x, uint16_t y) {
+    unsigned r = x + y;
+    f = (uint8_t)((f & (FS | FZ | FP)) | (((x ^ y ^ r) >> 8) & FH) |
+                  ((r >> 8) & (FY | FX)) | (r >> 16));
+    return (uint16_t)r;
+}
+
+void Z80::adc16(uint16_t v) {
+    uint16_t x = hl();
+    unsigned r = x + v + (f & FC);
+    f = (uint8_t)(((r >> 8) & (FS | FY | FX)) | ((r & 0xFFFF) ? 0 : FZ) |
+                  (((x ^ v ^ r) >> 8) & FH) | (((x ^ ~v) & (x ^ r) & 0x8000) ? FP : 0) | (r >> 16));
+    h = (uint8_t)(r >> 8);
+    l = (uint8_t)r;
+}
+
+void Z80::sbc16(uint16_t v) {
+    uint16_t x = hl();
+    unsigned r = x - v - (f & FC);
+    f = (uint8_t)(((r >> 8) & (FS | FY | FX)) | ((r & 0xFFFF) ? 0 : FZ) | FN |
+                  (((x ^ v ^ r) >> 8) & FH) | (((x ^ v) & (x ^ r) & 0x8000) ? FP : 0) | ((r >> 16) & FC));
+    h = (uint8_t)(r >> 8);
+    l = (uint8_t)r;
+}
+
+void Z80::daa() {
+    uint8_t corr = 0, carry = f & FC, half;
+    if ((f & FH) || (a & 0x0F) > 9) corr |= 0x06;
+    if (carry || a > 0x99) { corr |= 0x60; carry = FC; }
+    if (f & FN) half = (f & FH) && (a & 0x0F) < 6 ? FH : 0;
+    else        half = (a & 0x0F) > 9 ? FH : 0;
+    a = (uint8_t)(f & FN ? a - corr : a + corr);
+    f = (uint8_t)(sz53p(a) | (f & FN) | half | carry);
+}
+
+void Z80::step() {
+    ei_delay_ = false;
+    if (halted) {
+        // The CPU keeps executing NOPs, and refreshing, until an interrupt
+        r_++;
+        t += 4;
+        return;
+    }
+    prefix_ = 0;
+    uint8_t op = m1();
+    while (op == 0xDD || op == 0xFD) {
+        prefix_ = op;
+        t += 4;
+        op = m1();
+    }
+    if (op == 0xED) {
+        prefix_ = 0;
+        exec_ed();
+    } else {
+        exec(op);
+    }
+}
+
+void Z80::nmi() {
+    halted = false;
+    r_++;
+    iff1 = false;
+    push(pc);
+    pc = 0x0066;
+    t += 11;
+}
+
+void Z80::irq(uint8_t data) {
+    halted = false;
+    r_++;
+    iff1 = iff2 = false;
+    push(pc);
+    if (im == 2) {
+        pc = rd16((uint16_t)(i << 8 | data));
+        t += 19;
+    } else {
+        // Mode 0 is only ever seen with $FF (RST 38) on the bus
+        pc = im == 1 ? 0x0038 : (uint16_t)(data & 0x38);
+        t += 13;
+    }
+}
+
+void Z80::exec(uint8_t op) {
+    const int x = op >> 6, y = (op >> 3) & 7, z = op & 7, p = y >> 1, q = y & 1;
+
+    // (HL), or (IX+d)/(IY+d) under a prefix, which costs 8 more (5 for LD (IX+d),n)
+    auto mem = [&](int extra) -> uint16_t {
+        if (!prefix_) return hl();
+        int8_t disp = (int8_t)imm();
+        t += extra;
+        return (uint16_t)(hl_x() + disp);
+    };
+
+    switch (x) {
+    case 0:
+        switch (z) {
+        case 0:
+            switch (y) {
+            case 0: t += 4; break;  // NOP
+            case 1: {               // EX AF,AF'
+                uint8_t ta = a, tf = f;
+                a = a_; f = f_; a_ = ta; f_ = tf;
+                t += 4;
+                break;
+            }
+            case 2: {               // DJNZ
+                int8_t disp = (int8_t)imm();
+                if (--b) { pc = (uint16_t)(pc + disp); t += 13; }
+                else t += 8;
+                break;
+            }
+            case 3: {               // JR
+                int8_t disp = (int8_t)imm();
+                pc = (uint16_t)(pc + disp);
+                t += 12;
+                break;
+            }
+            default: {              // JR cc
+                int8_t disp = (int8_t)imm();
+                if (cond(y - 4)) { pc = (uint16_t)(pc + disp); t += 12; }
+                else t += 7;
+                break;
+            }
+            }
+            break;
+        case 1:
+            if (!q) { set_rp(p, imm16()); t += 10; }
+            else { set_hl_x(add16(hl_x(), rp(p))); t += 11; }
+            break;
+        case 2:
+            switch (y) {
+            case 0: wr(bc(), a); t += 7; break;
+            case 1: a = rd(bc()); t += 7; break;
+            case 2: wr(de(), a); t += 7; break;
+            case 3: a = rd(de()); t += 7; break;
+            case 4: wr16(imm16(), hl_x()); t += 16; break;
+            case 5: set_hl_x(rd16(imm16())); t += 16; break;
+            case 6: wr(imm16(), a); t += 13; break;
+            default: a = rd(imm16()); t += 13; break;
+            }
+            break;
+        case 3:
+            set_rp(p, (uint16_t)(rp(p) + (q ? -1 : 1)));
+            t += 6;
+            break;
+        case 4:
+        case 5:
+            if (y == 6) {
+                uint16_t addr = mem(8);
+                wr(addr, z == 4 ? inc8(rd(addr)) : dec8(rd(addr)));
+                t += 11;
+            } else {
+                set_x(y, z == 4 ? inc8(get_x(y)) : dec8(get_x(y)));
+                t += 4;
+            }
+            break;
+        case 6:
+            if (y == 6) {
+                uint16_t addr = mem(5);
+                wr(addr, imm());
+                t += 10;
+            } else {
+                set_x(y, imm());
+                t += 7;
+            }
+            break;
+        default: {
+            uint8_t carry;
+            switch (y) {
+            case 0: carry = a >> 7; a = (uint8_t)(a << 1 | carry); break;                 // RLCA
+            case 1: carry = a & 1;  a = (uint8_t)(a >> 1 | carry << 7); break;            // RRCA
+            case 2: carry = a >> 7; a = (uint8_t)(a << 1 | (f & FC)); break;             // RLA
+            case 3: carry = a & 1;  a = (uint8_t)(a >> 1 | (f & FC) << 7); break;        // RRA
+            case 4: daa(); t += 4; return;
+            case 5: a = (uint8_t)~a; f = (uint8_t)((f & (FS | FZ | FP | FC)) | FH | FN | (a & (FY | FX))); t += 4; return;
+            case 6: f = (uint8_t)((f & (FS | FZ | FP)) | FC | (a & (FY | FX))); t += 4; return;          // SCF
+            default: f = (uint8_t)(((f & (FS | FZ | FP | FC)) | ((f & FC) << 4) | (a & (FY | FX))) ^ FC); t += 4; return; // CCF
+            }
+            f = (uint8_t)((f & (FS | FZ | FP)) | (a & (FY | FX)) | carry);
+            t += 4;
+            break;
+        }
+        }
+        break;
+
+    case 1:
+        if (y == 6 && z == 6) {     // HALT
+            halted = true;
+            t += 4;
+        } else if (y == 6) {        // LD (HL),r always stores the real H and L
+            uint16_t addr = mem(8);
+            wr(addr, reg(z));
+            t += 7;
+        } else if (z == 6) {
+            uint16_t addr = mem(8);
+            reg(y) = rd(addr);
+            t += 7;
+        } else {
+            set_x(y, get_x(z));
+            t += 4;
+        }
+        break;
+
+    case 2:
+        if (z == 6) { alu(y, rd(mem(8))); t += 7; }
+        else { alu(y, get_x(z)); t += 4; }
+        break;
+
+    default:
+        switch (z) {
+        case 0:                     // RET cc
+            if (cond(y)) { pc = pop(); t += 11; }
+            else t += 5;
+            break;
+        case 1:
+            if (!q) { set_rp2(p, pop()); t += 10; break; }
+            switch (p) {
+            case 0: pc = pop(); t += 10; break;
+            case 1: {               // EXX
+                uint8_t tb = b, tc = c, td = d, te = e, th = h, tl = l;
+                b = b_; c = c_; d = d_; e = e_; h = h_; l = l_;
+                b_ = tb; c_ = tc; d_ = td; e_ = te; h_ = th; l_ = tl;
+                t += 4;
+                break;
+            }
+            case 2: pc = hl_x(); t += 4; break;
+            default: sp = hl_x(); t += 6; break;
+            }
+            break;
+        case 2: {                   // JP cc,nn
+            uint16_t target = imm16();
+            if (cond(y)) pc = target;
+            t += 10;
+            break;
+        }
+        case 3:
+            switch (y) {
+            case 0: pc = imm16(); t += 10; break;
+            case 1:
+                if (prefix_) {
+                    int8_t disp = (int8_t)imm();
+                    uint16_t addr = (uint16_t)(hl_x() + disp);
+                    exec_cb(addr, true);
+                } else {
+                    exec_cb(hl(), false);
+                }
+                break;
+            case 2: {
+                uint8_t n = imm();
+                bus_.out((uint16_t)(a << 8 | n), a);
+                t += 11;
+                break;
+            }
+            case 3: {
+                uint8_t n = imm();
+                a = bus_.in((uint16_t)(a << 8 | n));
+                t += 11;
+                break;
+            }
+            case 4: {               // EX (SP),HL
+                uint16_t v = rd16(sp);
+                wr16(sp, hl_x());
+                set_hl_x(v);
+                t += 19;
+                break;
+            }
+            case 5: {               // EX DE,HL ignores the index prefixes
+                uint8_t td = d, te = e;
+                d = h; e = l; h = td; l = te;
+                t += 4;
+                break;
+            }
+            case 6: iff1 = iff2 = false; t += 4; break;
+            default: iff1 = iff2 = true; ei_delay_ = true; t += 4; break;
+            }
+            break;
+        case 4: {                   // CALL cc,nn
+            uint16_t target = imm16();
+            if (cond(y)) { push(pc); pc = target; t += 17; }
+            else t += 10;
+            break;
+        }
+        case 5:
+            if (!q) { push(rp2(p)); t += 11; }
+            else {                  // CALL nn; the prefixes never get here
+                uint16_t target = imm16();
+                push(pc);
+                pc = target;
+                t += 17;
+            }
+            break;
+        case 6: alu(y, imm()); t += 7; break;
+        default: push(pc); pc = (uint16_t)(y * 8); t += 11; break;  // RST
+        }
+        break;
+    }
+}
+
+void Z80::exec_cb(uint16_t addr, bool indexed) {
+    // DDCB d op: the opcode is read as data, so R only moved for DD and CB
+    uint8_t op = indexed ? imm() : m1();
+    const int x = op >> 6, y = (op >> 3) & 7, z = op & 7;
+    const bool memory = indexed || z == 6;
+    uint8_t v = memory ? rd(addr) : reg(z);
+
+    if (x == 1) {                   // BIT
+        uint8_t r = v & (1 << y);
+        f = (uint8_t)((f & FC) | FH | (r ? 0 : FZ | FP) | (r & FS) | (v & (FY | FX)));
+        t += indexed ? 16 : memory ? 12 : 8;
+        return;
+    }
+
+    if (x == 0) v = rot(y, v);
+    else if (x == 2) v = (uint8_t)(v & ~(1 << y));
+    else v = (uint8_t)(v | (1 << y));
+
+    if (memory) wr(addr, v);
+    // The undocumented DDCB forms also copy the result to a register
+    if (!memory || (indexed && z != 6)) reg(z) = v;
+    t += indexed ? 19 : memory ? 15 : 8;
+}
+
+void Z80::exec_ed() {
+    uint8_t op = m1();
+    const int x = op >> 6, y = (op >> 3) & 7, z = op & 7, p = y >> 1, q = y & 1;
+
+    if (x == 1) {
+        switch (z) {
+        case 0: {                   // IN r,(C)
+            uint8_t v = bus_.in(bc());
+            f = (uint8_t)((f & FC) | sz53p(v));
+            if (y != 6) reg(y) = v;
+            t += 12;
+            break;
+        }
+        case 1:
+            bus_.out(bc(), y == 6 ? 0 : reg(y));
+            t += 12;
+            break;
+        case 2:
+            if (q) adc16(rp(p)); else sbc16(rp(p));
+            t += 15;
+            break;
+        case 3: {
+            uint16_t addr = imm16();
+            if (q) set_rp(p, rd16(addr)); else wr16(addr, rp(p));
+            t += 20;
+            break;
+        }
+        case 4: {                   // NEG
+            uint8_t v = a;
+            a = 0;
+            alu(2, v);
+            t += 8;
+            break;
+        }
+        case 5:                     // RETN, RETI
+            iff1 = iff2;
+            pc = pop();
+            t += 14;
+            break;
+        case 6:
+            im = (uint8_t)((y & 3) < 2 ? 0 : (y & 3) - 1);
+            t += 8;
+            break;
+        default:
+            switch (y) {
+            case 0: i = a; t += 9; break;
+            case 1: r_ = a; r7_ = a & 0x80; t += 9; break;
+            case 2:
+            case 3:
+                a = y == 2 ? i : r();
+                f = (uint8_t)((f & FC) | sz53(a) | (iff2 ? FP : 0));
+                t += 9;
+                break;
+            case 4:
+            case 5: {               // RRD, RLD
+                uint8_t v = rd(hl());
+                if (y == 4) {
+                    wr(hl(), (uint8_t)(a << 4 | v >> 4));
+                    a = (uint8_t)((a & 0xF0) | (v & 0x0F));
+                } else {
+                    wr(hl(), (uint8_t)(v << 4 | (a & 0x0F)));
+                    a = (uint8_t)((a & 0xF0) | v >> 4);
+                }
+                f = (uint8_t)((f & FC) | sz53p(a));
+                t += 18;
+                break;
+            }
+            default: t += 8; break;
+            }
+            break;
+        }
+        return;
+    }
+
+    if (x != 2 || y < 4 || z > 3) {  // everything else is an 8 T-state NOP
+        t += 8;
+        return;
+    }
+
+    // Block instructions: y bit 0 picks decrement, y bit 1 picks repeat
+    const int step = (y & 1) ? -1 : 1;
+    const bool repeat = y & 2;
+    bool again = false;
+    uint16_t hl_now = hl();
+    switch (z) {
+    case 0: {                       // LDI LDD LDIR LDDR
+        uint8_t v = rd(hl_now);
+        uint16_t de_now = de();
+        wr(de_now, v);
+        de_now = (uint16_t)(de_now + step);
+        d = (uint8_t)(de_now >> 8); e = (uint8_t)de_now;
+        uint16_t count = (uint16_t)(bc() - 1);
+        b = (uint8_t)(count >> 8); c = (uint8_t)count;
+        uint8_t n = (uint8_t)(v + a);
+        f = (uint8_t)((f & (FS | FZ | FC)) | (count ? FP : 0) | (n & FX) | ((n & 0x02) ? FY : 0));
+        again = repeat && count;
+        break;
+    }
+    case 1: {                       // CPI CPD CPIR CPDR
+        uint8_t v = rd(hl_now);
+        uint8_t r = (uint8_t)(a - v);
+        uint16_t count = (uint16_t)(bc() - 1);
+        b = (uint8_t)(count >> 8); c = (uint8_t)count;
+        uint8_t half = (a ^ v ^ r) & FH;
+        uint8_t n = (uint8_t)(r - (half ? 1 : 0));
+        f = (uint8_t)((f & FC) | (sz53(r) & (FS | FZ)) | FN | half | (count ? FP : 0) |
+                      (n & FX) | ((n & 0x02) ? FY : 0));
+        again = repeat && count && r;
+        break;
+    }
+    case 2: {                       // INI IND INIR INDR
+        uint8_t v = bus_.in(bc());
+        wr(hl_now, v);
+        b--;
+        f = (uint8_t)((f & FC) | sz53(b) | FN);
+        again = repeat && b;
+        break;
+    }
+    default: {                      // OUTI OUTD OTIR OTDR
+        uint8_t v = rd(hl_now);
+        b--;
+        bus_.out(bc(), v);
+        f = (uint8_t)((f & FC) | sz53(b) | FN);
+        again = repeat && b;
+        break;
+    }
+    }
+    hl_now = (uint16_t)(hl_now + step);
+    h = (uint8_t)(hl_now >> 8); l = (uint8_t)hl_now;
+    if (again) { pc -= 2; t += 21; }
+    else t += 16;
+}
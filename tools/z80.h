@@ -0,0 +1,85 @@
+// z80.h - small Z80 core with exact instruction timings, for boot benchmarks
+#pragma once
+
+#include <cstdint>
+
+class Z80 {
+public:
+    // The machine around the CPU. fetch() is the opcode (M1) read, which the
+    // ZX81 video hardware intercepts when executing the display file.
+    struct Bus {
+        virtual ~Bus() = default;
+        virtual uint8_t read(uint16_t addr) = 0;
+        virtual void write(uint16_t addr, uint8_t value) = 0;
+        virtual uint8_t fetch(uint16_t addr) { return read(addr); }
+        virtual uint8_t in(uint16_t port) = 0;
+        virtual void out(uint16_t port, uint8_t value) = 0;
+    };
+
+    explicit Z80(Bus& bus) : bus_(bus) { reset(); }
+
+    void reset();
+
+    // Executes one instruction (or one NOP cycle while halted)
+    void step();
+    // Accept an interrupt; these do not check whether one can be taken
+    void nmi();
+    void irq(uint8_t data = 0xFF);
+    // A maskable interrupt is not taken directly after EI
+    bool irq_enabled() const { return iff1 && !ei_delay_; }
+
+    uint8_t r() const { return (uint8_t)((r_ & 0x7F) | r7_); }
+
+    uint16_t bc() const { return (uint16_t)(b << 8 | c); }
+    uint16_t de() const { return (uint16_t)(d << 8 | e); }
+    uint16_t hl() const { return (uint16_t)(h << 8 | l); }
+
+    uint8_t a = 0xFF, f = 0xFF, b = 0, c = 0, d = 0, e = 0, h = 0, l = 0;
+    uint8_t a_ = 0, f_ = 0, b_ = 0, c_ = 0, d_ = 0, e_ = 0, h_ = 0, l_ = 0;
+    uint16_t ix = 0xFFFF, iy = 0xFFFF, sp = 0xFFFF, pc = 0;
+    uint8_t i = 0, im = 0;
+    bool iff1 = false, iff2 = false, halted = false;
+    uint64_t t = 0;  // T-states since reset
+
+private:
+    uint8_t  rd(uint16_t addr) { return bus_.read(addr); }
+    void     wr(uint16_t addr, uint8_t v) { bus_.write(addr, v); }
+    uint16_t rd16(uint16_t addr) { return (uint16_t)(rd(addr) | rd((uint16_t)(addr + 1)) << 8); }
+    void     wr16(uint16_t addr, uint16_t v) { wr(addr, (uint8_t)v); wr((uint16_t)(addr + 1), (uint8_t)(v >> 8)); }
+    uint8_t  m1() { r_++; return bus_.fetch(pc++); }
+    uint8_t  imm() { return rd(pc++); }
+    uint16_t imm16() { uint16_t v = rd16(pc); pc += 2; return v; }
+    void     push(uint16_t v) { sp -= 2; wr16(sp, v); }
+    uint16_t pop() { uint16_t v = rd16(sp); sp += 2; return v; }
+
+    // Register operands by their 3-bit code; 6 is not a register
+    uint8_t& reg(int code);
+    uint8_t  get_x(int code);  // with H/L replaced by the index register halves
+    void     set_x(int code, uint8_t v);
+    uint16_t rp(int code);     // BC DE HL SP (HL as the current index register)
+    void     set_rp(int code, uint16_t v);
+    uint16_t rp2(int code);    // BC DE HL AF
+    void     set_rp2(int code, uint16_t v);
+    bool     cond(int code) const;
+
+    uint16_t  hl_x() const { return prefix_ == 0xDD ? ix : prefix_ == 0xFD ? iy : (uint16_t)(h << 8 | l); }
+    void      set_hl_x(uint16_t v);
+
+    void alu(int op, uint8_t v);
+    uint8_t inc8(uint8_t v);
+    uint8_t dec8(uint8_t v);
+    uint8_t rot(int op, uint8_t v);
+    uint16_t add16(uint16_t x, uint16_t y);
+    void adc16(uint16_t v);
+    void sbc16(uint16_t v);
+    void daa();
+
+    void exec(uint8_t op);
+    void exec_cb(uint16_t addr, bool indexed);
+    void exec_ed();
+
+    Bus& bus_;
+    uint8_t r_ = 0, r7_ = 0;
+    uint8_t prefix_ = 0;
+    bool ei_delay_ = false;
+};
@@ -0,0 +1,535 @@
+// zx7bench.cpp - encoder benchmark: speed, peak memory and size per corpus file,
+// checked against the frozen reference encoder and a stored baseline
+//
+// The corpus is generated from a fixed seed, so every machine benchmarks the
+// same bytes: three P-files shaped like real ones (a BASIC program with its
+// display file, machine code in a REM line, screens of block graphics) and
+// the worst cases for the match finders (zeros, random bytes, a two-symbol
+// alphabet that puts every position of the window on one hash chain, and a
+// 48K input). P-files named on the command line are benchmarked as well.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+#include <sys/resource.h>
+
+extern "C" {
+    #include "../zx7/zx7.h"
+    #include "zx7ref.h"
+}
+
+namespace {
+
+struct CorpusFile {
+    std::string name;
+    std::vector<uint8_t> data;
+};
+
+// xorshift32; the corpus depends on its exact sequence
+struct Rng {
+    uint32_t s;
+    explicit Rng(uint32_t seed) : s(seed) {}
+    uint32_t next() {
+        s ^= s << 13;
+        s ^= s >> 17;
+        s ^= s << 5;
+        return s;
+    }
+    uint32_t below(uint32_t n) { return next() % n; }
+};
+
+// ZX81 character codes and BASIC tokens
+const uint8_t NEWLINE = 0x76, NUMBER = 0x7E, QUOTE = 0x0B;
+const uint8_t KEYWORDS[] = { 0xF5 /* PRINT */, 0xF1 /* LET */, 0xFA /* IF */, 0xEC /* GOTO */,
+                             0xEB /* FOR */, 0xF3 /* NEXT */, 0xF4 /* POKE */, 0xED /* GOSUB */,
+                             0xEA /* REM */, 0xF9 /* RAND */ };
+const uint8_t OPERATORS[] = { 0x14 /* = */, 0x15 /* + */, 0x16 /* - */, 0x17 /* * */,
+                              0x12 /* > */, 0x13 /* < */, 0xDA /* AND */, 0xDE /* THEN */ };
+
+void put16(std::vector<uint8_t>& out, size_t at, size_t value) {
+    out[at] = (uint8_t)value;
+    out[at + 1] = (uint8_t)(value >> 8);
+}
+
+// The 5-byte floating point form of n
+void put_float(std::vector<uint8_t>& out, uint32_t n) {
+    if (n == 0) {
+        out.insert(out.end(), 5, 0);
+        return;
+    }
+    int exponent = 0;
+    while (exponent < 32 && (n >> exponent) != 0) exponent++;
+    uint32_t mantissa = n << (32 - exponent);
+    out.push_back((uint8_t)(0x80 + exponent));
+    out.push_back((uint8_t)((mantissa >> 24) & 0x7F));
+    out.push_back((uint8_t)(mantissa >> 16));
+    out.push_back((uint8_t)(mantissa >> 8));
+    out.push_back((uint8_t)mantissa);
+}
+
+// A number literal as the ZX81 stores it: its digits, then NUMBER and the value
+void put_number(std::vector<uint8_t>& out, uint32_t n) {
+    for (char c : std::to_string(n)) out.push_back((uint8_t)(0x1C + (c - '0')));
+    out.push_back(NUMBER);
+    put_float(out, n);
+}
+
+void put_line(std::vector<uint8_t>& out, uint16_t number, const std::vector<uint8_t>& body) {
+    out.push_back((uint8_t)(number >> 8));
+    out.push_back((uint8_t)number);
+    out.push_back((uint8_t)((body.size() + 1) & 0xFF));
+    out.push_back((uint8_t)((body.size() + 1) >> 8));
+    out.insert(out.end(), body.begin(), body.end());
+    out.push_back(NEWLINE);
+}
+
+std::vector<uint8_t> basic_statement(Rng& rng) {
+    std::vector<uint8_t> s;
+    s.push_back(KEYWORDS[rng.below(sizeof KEYWORDS)]);
+    const int terms = 1 + (int)rng.below(4);
+    for (int t = 0; t < terms; t++) {
+        if (t) s.push_back(OPERATORS[rng.below(sizeof OPERATORS)]);
+        switch (rng.below(3)) {
+            case 0: s.push_back((uint8_t)(0x26 + rng.below(26))); break;  // variable A-Z
+            case 1: put_number(s, rng.below(4) ? rng.below(100) : rng.below(32768)); break;
+            default:
+                s.push_back(QUOTE);
+                for (uint32_t i = 0, n = 2 + rng.below(12); i < n; i++) {
+                    s.push_back(rng.below(5) ? (uint8_t)(0x26 + rng.below(26)) : 0x00);
+                }
+                s.push_back(QUOTE);
+                break;
+        }
+    }
+    return s;
+}
+
+// Z80 code: mostly one-byte register operations, loads and calls with a
+// handful of recurring targets, as compiled or hand-written games look
+void put_code(std::vector<uint8_t>& out, Rng& rng, size_t size) {
+    static const uint8_t one_byte[] = { 0x7E, 0x77, 0x23, 0x2B, 0x13, 0x1B, 0x78, 0x47, 0x79, 0x4F,
+                                        0xA7, 0xAF, 0xB7, 0xC9, 0xE5, 0xE1, 0xD5, 0xD1, 0xC5, 0xC1,
+                                        0x3C, 0x3D, 0x05, 0x0D, 0xEB, 0x1A, 0x12, 0x87, 0x85, 0x6F };
+    uint16_t targets[12];
+    for (uint16_t& t : targets) t = (uint16_t)(0x4082 + rng.below(0x2000));
+    const size_t end = out.size() + size;
+    while (out.size() < end) {
+        const uint32_t kind = rng.below(16);
+        if (kind < 9) {
+            out.push_back(one_byte[rng.below(sizeof one_byte)]);
+        } else if (kind < 12) {
+            static const uint8_t ld_n[] = { 0x3E, 0x06, 0x0E, 0x16, 0x1E, 0xFE, 0xE6 };
+            out.push_back(ld_n[rng.below(sizeof ld_n)]);
+            out.push_back((uint8_t)(rng.below(3) ? rng.below(32) : rng.next()));
+        } else if (kind < 15) {
+            static const uint8_t nn[] = { 0xCD, 0xC3, 0x21, 0x11, 0x01, 0x3A, 0x32, 0xCA, 0xC2 };
+            const uint16_t t = targets[rng.below(12)];
+            out.push_back(nn[rng.below(sizeof nn)]);
+            out.push_back((uint8_t)t);
+            out.push_back((uint8_t)(t >> 8));
+        } else {
+            out.push_back(0x20 + (uint8_t)(rng.below(2) * 8));  // JR NZ / JR Z
+            out.push_back((uint8_t)(0xF0 + rng.below(16)));
+        }
+    }
+    out.resize(end);
+}
+
+// A full (expanded) display file: 24 lines of 32 characters, each ending in
+// NEWLINE, with a few lines of text and graphics
+void put_display(std::vector<uint8_t>& out, Rng& rng, int busy) {
+    out.push_back(NEWLINE);
+    for (int y = 0; y < 24; y++) {
+        const bool text = (int)rng.below(24) < busy;
+        for (int x = 0; x < 32; x++) {
+            uint8_t c = 0x00;
+            if (text && rng.below(3)) c = (uint8_t)(0x26 + rng.below(26));
+            else if (y == 0 || y == 23) c = 0x80;  // border
+            out.push_back(c);
+        }
+        out.push_back(NEWLINE);
+    }
+}
+
+// A P-file around a program: the system variables from VERSN on, then the
+// program, display file and variables, with the pointers set to match
+std::vector<uint8_t> pfile(const std::vector<uint8_t>& program, Rng& rng, int busy) {
+    std::vector<uint8_t> p(116, 0);
+    p.insert(p.end(), program.begin(), program.end());
+    const size_t d_file = p.size();
+    put_display(p, rng, busy);
+    const size_t vars = p.size();
+    for (int v = 0; v < 4; v++) {
+        p.push_back((uint8_t)(0x60 | ((0x26 + v) & 0x1F)));  // numeric variable A-D
+        put_float(p, rng.below(1000));
+    }
+    p.push_back(0x80);
+    const size_t e_line = p.size();
+    p.push_back(NEWLINE);
+    p.push_back(0x80);
+
+    const size_t base = 0x4009;
+    put16(p, 0x400C - base, base + d_file);     // D_FILE
+    put16(p, 0x400E - base, base + d_file + 1); // DF_CC
+    put16(p, 0x4010 - base, base + vars);       // VARS
+    put16(p, 0x4014 - base, base + e_line);     // E_LINE
+    put16(p, 0x4016 - base, base + e_line);     // CH_ADD
+    put16(p, 0x401A - base, base + e_line + 1); // STKBOT
+    put16(p, 0x401C - base, base + e_line + 1); // STKEND
+    p[0x4022 - base] = 2;                       // DF_SZ
+    put16(p, 0x4023 - base, 2);                 // S_TOP
+    p[0x4028 - base] = 0x37;                    // MARGIN, 50 Hz
+    put16(p, 0x4029 - base, base + d_file);     // NXTLIN
+    p[0x403B - base] = 0x40;                    // CDFLAG, SLOW
+    put16(p, 0x4039 - base, 0x1821);            // S_POSN
+    return p;
+}
+
+std::vector<CorpusFile> generate_corpus() {
+    std::vector<CorpusFile> corpus;
+
+    {   // A BASIC game
+        // Programs repeat themselves: half of the lines reuse an earlier statement
+        Rng rng(0x81);
+        std::vector<std::vector<uint8_t>> seen;
+        std::vector<uint8_t> program;
+        for (uint16_t line = 10; program.size() < 5200; line += 10) {
+            if (seen.empty() || rng.below(2)) seen.push_back(basic_statement(rng));
+            put_line(program, line, seen[rng.below((uint32_t)seen.size())]);
+        }
+        corpus.push_back({ "basic.p", pfile(program, rng, 8) });
+    }
+    {   // Machine code in a REM line, with a short BASIC program to call it
+        Rng rng(0x1981);
+        std::vector<uint8_t> rem = { 0xEA };
+        put_code(rem, rng, 7000);
+        std::vector<uint8_t> program;
+        put_line(program, 1, rem);
+        for (uint16_t line = 10; line <= 60; line += 10) put_line(program, line, basic_statement(rng));
+        corpus.push_back({ "mcode.p", pfile(program, rng, 2) });
+    }
+    {   // Title and level screens in block graphics, each a variation of the first
+        Rng rng(0x4009);
+        std::vector<uint8_t> screen(24 * 33);
+        for (size_t i = 0; i < screen.size(); i++) {
+            screen[i] = i % 33 == 32 ? NEWLINE : rng.below(4) ? 0x00 : (uint8_t)(rng.below(2) ? 0x80 : 1 + rng.below(10));
+        }
+        std::vector<uint8_t> rem = { 0xEA };
+        for (int s = 0; s < 14; s++) {
+            for (int edits = 0; edits < 60; edits++) {
+                size_t at = rng.below((uint32_t)screen.size());
+                if (screen[at] != NEWLINE) screen[at] = (uint8_t)(0x80 + rng.below(11));
+            }
+            rem.insert(rem.end(), screen.begin(), screen.end());
+        }
+        std::vector<uint8_t> program;
+        put_line(program, 1, rem);
+        for (uint16_t line = 10; line <= 200; line += 10) put_line(program, line, basic_statement(rng));
+        corpus.push_back({ "screens.p", pfile(program, rng, 4) });
+    }
+
+    // Worst cases
+    corpus.push_back({ "zeros", std::vector<uint8_t>(16384, 0) });
+    {
+        Rng rng(16384);
+        std::vector<uint8_t> random(16384);
+        for (uint8_t& b : random) b = (uint8_t)rng.next();
+        corpus.push_back({ "random", random });
+    }
+    {
+        Rng rng(2);
+        std::vector<uint8_t> binary(16384);
+        for (uint8_t& b : binary) b = (uint8_t)(rng.next() & 1);
+        corpus.push_back({ "binary", binary });
+    }
+    {
+        std::vector<uint8_t> large;
+        for (int i = 0; i < 3; i++) {
+            for (size_t f = 0; f < 3; f++) large.insert(large.end(), corpus[f].data.begin(), corpus[f].data.end());
+        }
+        large.resize(49152);
+        corpus.push_back({ "large", large });
+    }
+    return corpus;
+}
+
+std::vector<uint8_t> slurp(const std::string& path) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f) { throw std::runtime_error("Cannot open: " + path); }
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(f)),
+                               std::istreambuf_iterator<char>());
+    return data;
+}
+
+std::string base_name(const std::string& path) {
+    size_t slash = path.find_last_of('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+struct Result {
+    std::string file;
+    std::string finder;
+    size_t size = 0;
+    size_t zx7 = 0;
+    double mbps = 0;
+    double relative = 0;  // speed over the reference encoder's on the same input
+    size_t peak = 0;
+    bool identical = false;
+};
+
+std::string key(const Result& r) {
+    return r.file + "/" + r.finder;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Compresses one file with each match finder (a fresh context every time)
+// and with the reference encoder, in turn, until min_time has passed for
+// each and at least three rounds are done, keeping the fastest run of each.
+// Interleaving them exposes all three to the same load on the machine, so
+// the speed relative to the reference is steadier than MB/s on its own.
+std::vector<Result> measure(const CorpusFile& f, double min_time) {
+    using clock = std::chrono::steady_clock;
+    const int finders[] = { ZX7_MATCH_TREE, ZX7_MATCH_HASH };
+    std::vector<Result> results(2);
+    double best[2] = {}, ref_best = 0, ref_total = 0;
+
+    for (int round = 0; round < 3 || ref_total < min_time; round++) {
+        size_t ref_size = 0;
+        auto start = clock::now();
+        unsigned char* ref = zx7ref_compress(f.data.data(), f.data.size(), 0, &ref_size);
+        const double ref_elapsed = seconds_since(start);
+        ref_total += ref_elapsed;
+        if (round == 0 || ref_elapsed < ref_best) ref_best = ref_elapsed;
+
+        for (int i = 0; i < 2; i++) {
+            ZX7Context* ctx = zx7_create();
+            if (!ctx) {
+                std::free(ref);
+                throw std::runtime_error("out of memory");
+            }
+            ctx->match_finder = finders[i];
+            unsigned char* out = nullptr;
+            size_t out_size = 0;
+            long delta = 0;
+
+            start = clock::now();
+            const int rc = zx7_compress(ctx, f.data.data(), f.data.size(), 0, &out, &out_size, &delta);
+            const double elapsed = seconds_since(start);
+            if (rc != ZX7_OK) {
+                zx7_destroy(ctx);
+                std::free(ref);
+                throw std::runtime_error(f.name + ": zx7_compress failed (" + std::to_string(rc) + ")");
+            }
+            if (round == 0) {
+                Result& r = results[i];
+                r.file = f.name;
+                r.finder = finders[i] == ZX7_MATCH_TREE ? "tree" : "hash";
+                r.size = f.data.size();
+                r.zx7 = out_size;
+                r.peak = ctx->peak_bytes;
+                r.identical = out_size == ref_size && std::memcmp(out, ref, ref_size) == 0;
+            }
+            zx7_destroy(ctx);
+            if (round == 0 || elapsed < best[i]) best[i] = elapsed;
+        }
+        std::free(ref);
+    }
+    for (int i = 0; i < 2; i++) {
+        results[i].mbps = best[i] > 0 ? f.data.size() / best[i] / 1e6 : 0;
+        results[i].relative = best[i] > 0 ? ref_best / best[i] : 0;
+    }
+    return results;
+}
+
+void write_baseline(const std::string& path, const std::vector<Result>& results) {
+    std::ofstream f(path);
+    if (!f) throw std::runtime_error("Cannot write: " + path);
+    f << "{\n  \"encoder\": \"" << ZX7_ENCODER_VERSION << "\",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        char mbps[32], relative[32];
+        std::snprintf(mbps, sizeof mbps, "%.3f", r.mbps);
+        std::snprintf(relative, sizeof relative, "%.3f", r.relative);
+        f << "    {\"file\": \"" << r.file << "\", \"finder\": \"" << r.finder << "\", \"size\": " << r.size
+          << ", \"zx7\": " << r.zx7 << ", \"mbps\": " << mbps << ", \"relative\": " << relative
+          << ", \"peak\": " << r.peak << "}"
+          << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    f << "  ]\n}\n";
+}
+
+// The value of "name": in one flat JSON object, as text without quotes
+std::string field(const std::string& object, const std::string& name) {
+    const std::string tag = "\"" + name + "\"";
+    size_t at = object.find(tag);
+    if (at == std::string::npos) return "";
+    at = object.find(':', at + tag.size());
+    if (at == std::string::npos) return "";
+    at = object.find_first_not_of(" \t\r\n", at + 1);
+    if (at == std::string::npos) return "";
+    if (object[at] == '"') {
+        size_t end = object.find('"', at + 1);
+        return end == std::string::npos ? "" : object.substr(at + 1, end - at - 1);
+    }
+    size_t end = object.find_first_of(",} \t\r\n", at);
+    return object.substr(at, end == std::string::npos ? std::string::npos : end - at);
+}
+
+// Reads what write_baseline() writes: one object per result in "results"
+std::map<std::string, Result> read_baseline(const std::string& path) {
+    std::vector<uint8_t> raw = slurp(path);
+    const std::string text(raw.begin(), raw.end());
+    size_t at = text.find("\"results\"");
+    if (at == std::string::npos) throw std::runtime_error(path + ": no \"results\" array");
+
+    std::map<std::string, Result> baseline;
+    while ((at = text.find('{', at)) != std::string::npos) {
+        size_t end = text.find('}', at);
+        if (end == std::string::npos) throw std::runtime_error(path + ": unterminated object");
+        const std::string object = text.substr(at, end - at + 1);
+        Result r;
+        r.file = field(object, "file");
+        r.finder = field(object, "finder");
+        r.size = std::strtoull(field(object, "size").c_str(), nullptr, 10);
+        r.zx7 = std::strtoull(field(object, "zx7").c_str(), nullptr, 10);
+        r.mbps = std::strtod(field(object, "mbps").c_str(), nullptr);
+        r.relative = std::strtod(field(object, "relative").c_str(), nullptr);
+        r.peak = std::strtoull(field(object, "peak").c_str(), nullptr, 10);
+        if (r.file.empty() || r.finder.empty()) throw std::runtime_error(path + ": result without file or finder");
+        baseline[key(r)] = r;
+        at = end + 1;
+    }
+    return baseline;
+}
+
+// Size and peak memory are deterministic and must not grow at all. Speed is
+// judged by the ratio to the reference encoder alone: the two run interleaved
+// on the same input, so a busy or different machine slows both and the ratio
+// holds, while MB/s does not. What noise is left is covered by a wide
+// tolerance.
+int compare(const std::vector<Result>& results, const std::map<std::string, Result>& baseline, double tolerance) {
+    int regressions = 0;
+    for (const Result& r : results) {
+        auto it = baseline.find(key(r));
+        if (it == baseline.end()) {
+            std::printf("  %s: not in the baseline\n", key(r).c_str());
+            continue;
+        }
+        const Result& b = it->second;
+        if (b.size != r.size) {
+            std::printf("  %s: input is %zu bytes, the baseline's was %zu; regenerate it\n", key(r).c_str(), r.size, b.size);
+            regressions++;
+            continue;
+        }
+        if (r.zx7 > b.zx7) {
+            std::printf("  %s: compressed size %zu > %zu\n", key(r).c_str(), r.zx7, b.zx7);
+            regressions++;
+        }
+        if (r.peak > b.peak) {
+            std::printf("  %s: peak memory %zu > %zu bytes\n", key(r).c_str(), r.peak, b.peak);
+            regressions++;
+        }
+        const double floor = 1 - tolerance / 100;
+        if (r.relative < b.relative * floor) {
+            std::printf("  %s: %.2fx the reference, the baseline has %.2fx (%.2f MB/s, was %.2f)\n", key(r).c_str(),
+                        r.relative, b.relative, r.mbps, b.mbps);
+            regressions++;
+        }
+    }
+    return regressions;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    std::string baseline_path, write_path;
+    double tolerance = 40;
+    double min_time = 0.25;
+
+    static const option long_opts[] = {
+        {"baseline",       required_argument, nullptr, 'b'},
+        {"write-baseline", required_argument, nullptr, 'w'},
+        {"tolerance",      required_argument, nullptr, 't'},
+        {"time",           required_argument, nullptr, 's'},
+        {"help",           no_argument,       nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "b:w:t:s:h", long_opts, nullptr)) != -1) {
+        switch (opt) {
+            case 'b': baseline_path = optarg; break;
+            case 'w': write_path = optarg; break;
+            case 't': tolerance = std::strtod(optarg, nullptr); break;
+            case 's': min_time = std::strtod(optarg, nullptr); break;
+            case 'h':
+            default:
+                std::cerr <<
+                  "Usage: " << argv[0] << " [-b baseline.json] [-w baseline.json] [-t pct] [-s sec] [file.p ...]\n"
+                  "  -b, --baseline FILE        Fail if a result regressed against FILE\n"
+                  "  -w, --write-baseline FILE  Record the results as the new baseline\n"
+                  "  -t, --tolerance PCT        Drop in speed relative to the reference allowed (default 40)\n"
+                  "  -s, --time SEC             Minimum time per file and encoder (default 0.25)\n"
+                  "  Compresses the built-in corpus and any files given with both match finders, and\n"
+                  "  checks every output against the frozen reference encoder (tools/zx7ref.c).\n";
+                return (opt=='h') ? 0 : 1;
+        }
+    }
+
+    try {
+        std::vector<CorpusFile> corpus = generate_corpus();
+        for (int i = optind; i < argc; i++) corpus.push_back({ base_name(argv[i]), slurp(argv[i]) });
+
+        std::vector<Result> results;
+        int mismatches = 0;
+        std::printf("%-14s %7s %7s %6s  %-6s %8s %7s %9s  %s\n", "file", "bytes", "zx7", "ratio", "finder",
+                    "MB/s", "vs ref", "peak KB", "reference");
+        for (const CorpusFile& f : corpus) {
+            for (const Result& r : measure(f, min_time)) {
+                std::printf("%-14s %7zu %7zu %5.1f%%  %-6s %8.2f %6.2fx %9.1f  %s\n", r.file.c_str(), r.size, r.zx7,
+                            100.0 * r.zx7 / r.size, r.finder.c_str(), r.mbps, r.relative, r.peak / 1024.0,
+                            r.identical ? "identical" : "DIFFERS");
+                if (!r.identical) mismatches++;
+                results.push_back(r);
+            }
+            std::fflush(stdout);
+        }
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        std::printf("Max resident set size: %ld KB\n", usage.ru_maxrss);
+
+        int status = 0;
+        if (mismatches) {
+            std::printf("%d result(s) differ from the reference encoder\n", mismatches);
+            status = 1;
+        }
+        if (!baseline_path.empty()) {
+            std::printf("Against %s (speed tolerance %.0f%% relative to the reference):\n", baseline_path.c_str(),
+                        tolerance);
+            int regressions = compare(results, read_baseline(baseline_path), tolerance);
+            std::printf("  %d regression(s)\n", regressions);
+            if (regressions) status = 1;
+        }
+        if (!write_path.empty()) {
+            if (mismatches) throw std::runtime_error("not writing a baseline for output that differs from the reference");
+            write_baseline(write_path, results);
+            std::printf("Baseline written to %s\n", write_path.c_str());
+        }
+        return status;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 2;
+    }
+}
@@ -0,0 +1,216 @@
+// zx81.cpp - headless ZX81 (16K RAM pack) around the Z80 core, enough to boot a ROM image
+//
+// The video hardware is reduced to what the ROM's display code depends on:
+//   - the NMI generator (on with OUT ($FE), off with OUT ($FD)) fires once per
+//     207 T-state line,
+//   - opcodes fetched from the upper 32K echo with bit 6 clear are seen by
+//     the CPU as NOPs, so the display file executes as the ROM expects,
+//   - a maskable interrupt is raised while bit 6 of R is low.
+// The ULA's WAIT stretching that lines the HALT up with the NMI is left out,
+// which can move the end of a frame by a few T-states.
+#include "zx81.h"
+
+#include <cstring>
+
+ZX81::ZX81(const uint8_t* rom) : cpu(*this), mem_(2 * ROM_SIZE, 0) {
+    std::memcpy(mem_.data(), rom, ROM_SIZE);
+}
+
+namespace {
+
+// Row (half row in port address order, $FEFE first) and bit of a key
+bool key_matrix(char key, int& row, int& bit) {
+    static const char* const rows[8] = { "^ZXCV", "ASDFG", "QWERT", "12345",
+                                         "09876", "POIUY", "\nLKJH", " .MNB" };
+    for (row = 0; row < 8; row++) {
+        const char* at = key ? std::strchr(rows[row], key) : nullptr;
+        if (at) {
+            bit = (int)(at - rows[row]);
+            return true;
+        }
+    }
+    return false;
+}
+
+}  // namespace
+
+bool ZX81::has_key(char key) {
+    int row, bit;
+    return key_matrix(key, row, bit);
+}
+
+bool ZX81::press(char key) {
+    int row, bit;
+    if (!key_matrix(key, row, bit)) return false;
+    keys_[row] |= (uint8_t)(1 << bit);
+    return true;
+}
+
+// 8K ROM + upper 8K at $0000, 16K RAM at $4000; both are echoed in the upper 32K
+uint8_t ZX81::read(uint16_t addr) {
+    return mem_[addr & 0x7FFF];
+}
+
+void ZX81::write(uint16_t addr, uint8_t value) {
+    addr &= 0x7FFF;
+    if (addr >= ROM_SIZE) mem_[addr] = value;
+}
+
+uint8_t ZX81::fetch(uint16_t addr) {
+    uint8_t op = read(addr);
+    return (addr & 0x8000) && !(op & 0x40) ? 0x00 : op;
+}
+
+uint8_t ZX81::in(uint16_t port) {
+    if (port & 1) return 0xFF;
+    // Keyboard; bit 6 set is a 50 Hz machine, bit 7 is the (silent) tape input
+    uint8_t value = 0xFF;
+    for (int row = 0; row < 8; row++) {
+        if (!(port & (0x100 << row))) value &= (uint8_t)~keys_[row];
+    }
+    return value;
+}
+
+void ZX81::out(uint16_t port, uint8_t) {
+    if (!(port & 1)) nmi_on = true;
+    else if (!(port & 2)) nmi_on = false;
+}
+
+void ZX81::step() {
+    cpu.step();
+}
+
+bool ZX81::interrupt() {
+    bool nmi = false;
+    while (cpu.t >= next_line_) {
+        next_line_ += LINE_TSTATES;
+        nmi |= nmi_on;
+    }
+    if (nmi) {
+        cpu.nmi();
+        return true;
+    }
+    if (!(cpu.r() & 0x40) && cpu.irq_enabled()) {
+        cpu.irq();
+        return true;
+    }
+    return false;
+}
+
+namespace {
+
+// ROM routines a loader is likely to call
+const char* routine_name(uint16_t addr) {
+    switch (addr) {
+        case 0x0010: return "PRINT";
+        case 0x0207: return "SLOW/FAST";
+        case 0x02E7: return "FAST";
+        case 0x0A2A: return "CLS";
+        case 0x0F2B: return "SLOW";
+        case 0x0F4B: return "DEBOUNCE";
+        default:     return nullptr;
+    }
+}
+
+bool in_loader(uint16_t addr) {
+    return addr >= 0x2000 && addr < 0x4000;
+}
+
+// Length of a CALL/CALL cc/RST at op, 0 for anything else
+int call_length(uint8_t op) {
+    if (op == 0xCD || (op & 0xC7) == 0xC4) return 3;
+    if ((op & 0xC7) == 0xC7) return 1;
+    return 0;
+}
+
+}  // namespace
+
+BootResult boot_rom(const uint8_t* rom, char key, uint64_t limit) {
+    ZX81 zx(rom);
+    Z80& cpu = zx.cpu;
+    zx.press(key);
+
+    BootResult result;
+    auto phase = [&](const std::string& name, uint16_t entry) -> size_t {
+        for (size_t i = 0; i < result.phases.size(); i++) {
+            if (result.phases[i].name == name && result.phases[i].entry == entry) return i;
+        }
+        BootPhase p;
+        p.name = name;
+        p.entry = entry;
+        result.phases.push_back(p);
+        return result.phases.size() - 1;
+    };
+
+    const size_t startup = phase("start-up", 0);
+    size_t loader = 0;
+    bool started = false;
+
+    // The routine the loader is in and the interrupt the machine is in, each
+    // left when its return address is reached at the stack level it came from
+    bool in_call = false, in_irq = false;
+    size_t call_phase = 0;
+    uint16_t call_ret = 0, call_sp = 0;
+    uint16_t irq_ret = 0, irq_sp = 0;
+
+    while (cpu.t < limit) {
+        const uint16_t pc = cpu.pc, sp = cpu.sp;
+        const uint8_t op = zx.read(pc);
+        const size_t charge = !started ? startup : in_irq ? phase("display", 0)
+                            : in_call ? call_phase : loader;
+        uint64_t before = cpu.t;
+        zx.step();
+        result.phases[charge].tstates += cpu.t - before;
+
+        if (in_irq) {
+            in_irq = cpu.pc != irq_ret || cpu.sp != irq_sp;
+        } else if (!started) {
+            if (cpu.pc == 0x2000) {
+                started = true;
+                loader = phase("loader", 0);
+            }
+        } else if (in_call) {
+            if (cpu.pc == call_ret && cpu.sp == call_sp) {
+                in_call = false;
+                BootPhase& p = result.phases[call_phase];
+                // The program is decoded to $4009 and ends at its E_LINE; the
+                // decoder's registers say nothing reliable about where it stopped
+                if (p.name == "dzx7") p.bytes += (uint16_t)((zx.read(0x4014) | zx.read(0x4015) << 8) - 0x4009);
+            }
+        } else if (in_loader(pc)) {
+            const int len = call_length(op);
+            if (len && cpu.sp == (uint16_t)(sp - 2) && cpu.pc != (uint16_t)(pc + len)) {
+                // A taken call; the decompressor is recognised by its first instructions
+                // (LD A,$80 / LDI), the sysvar primer by PUSH HL / LD HL,nn / LD DE,$4009
+                const char* name = routine_name(cpu.pc);
+                bool dzx7 = in_loader(cpu.pc) && zx.read(cpu.pc) == 0x3E && zx.read(cpu.pc + 1) == 0x80
+                         && zx.read(cpu.pc + 2) == 0xED && zx.read(cpu.pc + 3) == 0xA0;
+                bool sysvars = in_loader(cpu.pc) && zx.read(cpu.pc) == 0xE5 && zx.read(cpu.pc + 1) == 0x21
+                            && zx.read(cpu.pc + 4) == 0x11 && zx.read(cpu.pc + 5) == 0x09 && zx.read(cpu.pc + 6) == 0x40;
+                call_phase = phase(dzx7 ? "dzx7" : sysvars ? "sysvars" : name ? name : "", cpu.pc);
+                result.phases[call_phase].calls++;
+                in_call = true;
+                call_ret = (uint16_t)(pc + len);
+                call_sp = sp;
+            } else if (cpu.pc == 0x0676 || cpu.pc == 0x0F2B) {
+                result.finished = true;
+                result.exit = cpu.pc;
+                break;
+            }
+        }
+
+        const uint16_t ret = cpu.pc, ret_sp = cpu.sp;
+        before = cpu.t;
+        if (zx.interrupt()) {
+            // Taken before the loader starts, it belongs to the start-up
+            result.phases[started ? phase("display", 0) : startup].tstates += cpu.t - before;
+            if (started && !in_irq) {
+                in_irq = true;
+                irq_ret = ret;
+                irq_sp = ret_sp;
+            }
+        }
+    }
+    result.tstates = cpu.t;
+    return result;
+}
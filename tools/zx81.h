@@ -0,0 +1,65 @@
+// zx81.h - headless ZX81 (16K RAM pack) around the Z80 core, enough to boot a ROM image
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "z80.h"
+
+class ZX81 : public Z80::Bus {
+public:
+    static const size_t ROM_SIZE = 16384;
+    static const unsigned LINE_TSTATES = 207;  // one TV line, the NMI period in SLOW mode
+
+    // rom is the 16K image seen at $0000-$3FFF
+    explicit ZX81(const uint8_t* rom);
+
+    // Holds a key down from now on: '0'-'9', 'A'-'Z', '.', ' ', '\n' (NEWLINE), '^' (SHIFT)
+    bool press(char key);
+    static bool has_key(char key);
+
+    // Runs one instruction
+    void step();
+    // Takes the NMI or display interrupt that is due after it, if any
+    bool interrupt();
+
+    Z80 cpu;
+    bool nmi_on = false;
+
+    uint8_t read(uint16_t addr) override;
+    void write(uint16_t addr, uint8_t value) override;
+    uint8_t fetch(uint16_t addr) override;
+    uint8_t in(uint16_t port) override;
+    void out(uint16_t port, uint8_t value) override;
+
+private:
+    std::vector<uint8_t> mem_;       // ROM, then RAM
+    uint8_t keys_[8] = {};           // pressed keys per half row, active high
+    uint64_t next_line_ = LINE_TSTATES;
+};
+
+// Where a boot spent its time
+struct BootPhase {
+    std::string name;      // "start-up", "loader", "display" or a routine the loader calls
+    uint16_t entry = 0;    // routine address, 0 for the others
+    uint64_t calls = 0;
+    uint64_t tstates = 0;
+    uint64_t bytes = 0;    // for the decompressor: bytes written
+};
+
+struct BootResult {
+    bool finished = false;   // reached the exit before the limit
+    uint16_t exit = 0;       // $0676 or $0F2B
+    uint64_t tstates = 0;
+    std::vector<BootPhase> phases;
+};
+
+// Boots rom from reset until the loader in the upper 8K jumps to LINERUN ($0676)
+// or SLOW ($0F2B). Every T-state lands in exactly one phase:
+//   start-up  reset until the ROM enters the loader at $2000
+//   loader    the loader's own instructions
+//   display   NMI and display interrupts taken while the loader runs (SLOW mode)
+//   routines  each routine the loader calls or RSTs, with what it calls in turn
+BootResult boot_rom(const uint8_t* rom, char key, uint64_t limit);
@@ -0,0 +1,77 @@
+// watch.cpp - waits for input files to change (inotify, Linux only)
+#include "watch.h"
+
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <set>
+#include <stdexcept>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace {
+
+// Directory and name of a path; "game.p" is in "."
+void split_path(const std::string& path, std::string& dir, std::string& name) {
+    auto slash = path.find_last_of('/');
+    if (slash == std::string::npos) {
+        dir = ".";
+        name = path;
+    } else {
+        dir = slash ? path.substr(0, slash) : "/";
+        name = path.substr(slash + 1);
+    }
+}
+
+} // namespace
+
+FileWatcher::FileWatcher() : fd_(inotify_init1(IN_CLOEXEC)) {
+    if (fd_ < 0) throw std::runtime_error("Cannot watch files: inotify is not available");
+}
+
+FileWatcher::~FileWatcher() {
+    ::close(fd_);
+}
+
+void FileWatcher::add(const std::string& path) {
+    std::string dir, name;
+    split_path(path, dir, name);
+    char real[PATH_MAX];
+    if (!realpath(dir.c_str(), real)) throw std::runtime_error("Cannot watch " + path);
+
+    // Closed after writing, or renamed into place
+    int wd = inotify_add_watch(fd_, real, IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (wd < 0) throw std::runtime_error("Cannot watch " + path);
+    dirs_[wd] = real;
+    files_[std::string(real) + "/" + name] = path;
+}
+
+std::vector<std::string> FileWatcher::wait(int quiet_ms) {
+    std::set<std::string> changed;
+    alignas(inotify_event) char buffer[4096];
+    int timeout = -1;  // until the first change
+
+    for (;;) {
+        pollfd p = { fd_, POLLIN, 0 };
+        int ready = poll(&p, 1, timeout);
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready < 0) throw std::runtime_error("Watching files failed");
+        if (ready == 0) break;
+
+        ssize_t n = ::read(fd_, buffer, sizeof buffer);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) throw std::runtime_error("Watching files failed");
+        for (ssize_t at = 0; at < n;) {
+            const inotify_event* e = reinterpret_cast<const inotify_event*>(buffer + at);
+            at += (ssize_t)(sizeof(inotify_event) + e->len);
+            auto dir = dirs_.find(e->wd);
+            if (dir == dirs_.end() || !e->len) continue;
+            auto file = files_.find(dir->second + "/" + e->name);
+            if (file != files_.end()) changed.insert(file->second);
+        }
+        if (!changed.empty()) timeout = quiet_ms;
+    }
+    return std::vector<std::string>(changed.begin(), changed.end());
+}
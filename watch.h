@@ -0,0 +1,33 @@
+// watch.h - waits for input files to change (inotify, Linux only)
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Watches the directories of the files it is given rather than the files
+// themselves, so a file replaced by a rename (as editors and emulators save)
+// is still seen. Throws std::runtime_error if inotify isn't available.
+class FileWatcher {
+public:
+    FileWatcher();
+    ~FileWatcher();
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    // Starts watching path; its directory must exist
+    void add(const std::string& path);
+    // Stops watching every file (their directories stay watched)
+    void clear() { files_.clear(); }
+    bool empty() const { return files_.empty(); }
+
+    // Blocks until a watched file has been written or replaced, then until
+    // nothing more has happened for quiet_ms; returns the changed files as
+    // they were passed to add()
+    std::vector<std::string> wait(int quiet_ms);
+
+private:
+    int fd_;
+    std::map<int, std::string> dirs_;           // watch descriptor -> real directory path
+    std::map<std::string, std::string> files_;  // real directory + "/" + name -> path as added
+};
@@ -0,0 +1,128 @@
+/*
+ * (c) Copyright 2012-2016 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "zx7.h"
+
+/*
+ * Backward match extension: given that the len bytes ending at a and b
+ * (a[0], a[-1], ..., a[1-len]) are equal, returns how far they keep being
+ * equal, up to limit. b[1-limit] must still be inside the input.
+ *
+ * The vector versions compare a whole block ending at a[-len] at once; the
+ * first mismatch going backwards is the highest differing lane. Building
+ * with -DZX7_NO_SIMD leaves only the byte loop.
+ */
+
+static size_t match_back_scalar(const unsigned char *a, const unsigned char *b, size_t len, size_t limit) {
+    while (len < limit && a[-(ptrdiff_t)len] == b[-(ptrdiff_t)len]) {
+        len++;
+    }
+    return len;
+}
+
+#if defined(ZX7_NO_SIMD)
+/* byte loop only */
+
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define ZX7_MATCH_X86 1
+#include <immintrin.h>
+
+static size_t match_back_sse2(const unsigned char *a, const unsigned char *b, size_t len, size_t limit) {
+    __m128i x;
+    __m128i y;
+    unsigned diff;
+
+    while (len+16 <= limit) {
+        x = _mm_loadu_si128((const __m128i *)(a - len - 15));
+        y = _mm_loadu_si128((const __m128i *)(b - len - 15));
+        diff = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xFFFF;
+        if (diff) {
+            return len + __builtin_clz(diff) - 16;
+        }
+        len += 16;
+    }
+    return match_back_scalar(a, b, len, limit);
+}
+
+__attribute__((target("avx2")))
+static size_t match_back_avx2(const unsigned char *a, const unsigned char *b, size_t len, size_t limit) {
+    __m256i x;
+    __m256i y;
+    unsigned diff;
+
+    while (len+32 <= limit) {
+        x = _mm256_loadu_si256((const __m256i *)(a - len - 31));
+        y = _mm256_loadu_si256((const __m256i *)(b - len - 31));
+        diff = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+        if (diff) {
+            return len + __builtin_clz(diff);
+        }
+        len += 32;
+    }
+    return match_back_sse2(a, b, len, limit);
+}
+
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_NEON) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define ZX7_MATCH_NEON 1
+#include <arm_neon.h>
+
+static size_t match_back_neon(const unsigned char *a, const unsigned char *b, size_t len, size_t limit) {
+    uint8x16_t eq;
+    uint64_t high;
+    uint64_t low;
+
+    while (len+16 <= limit) {
+        eq = vceqq_u8(vld1q_u8(a - len - 15), vld1q_u8(b - len - 15));
+        high = ~vgetq_lane_u64(vreinterpretq_u64_u8(eq), 1);
+        low = ~vgetq_lane_u64(vreinterpretq_u64_u8(eq), 0);
+        if (high) {
+            return len + __builtin_clzll(high)/8;
+        }
+        if (low) {
+            return len + 8 + __builtin_clzll(low)/8;
+        }
+        len += 16;
+    }
+    return match_back_scalar(a, b, len, limit);
+}
+#endif
+
+/* picks the widest version the running CPU supports */
+ZX7MatchBack zx7_match_back(void) {
+#if defined(ZX7_MATCH_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return match_back_avx2;
+    }
+    return match_back_sse2;
+#elif defined(ZX7_MATCH_NEON)
+    return match_back_neon;
+#else
+    return match_back_scalar;
+#endif
+}
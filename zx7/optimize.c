@@ -23,8 +23,8 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "zx7.h"
 
@@ -43,31 +43,46 @@ int count_bits(int offset, int len) {
     return 1 + (offset > 128 ? 12 : 8) + elias_gamma_bits(len-1);
 }
 
-Optimal* optimize(unsigned char *input_data, size_t input_size, long skip) {
-    size_t *min;
-    size_t *max;
-    size_t *matches;
-    size_t *match_slots;
-    Optimal *optimal;
-    size_t *match;
+int optimize(ZX7Context *ctx, const unsigned char *input_data, size_t input_size, long skip) {
+    uint32_t *min;
+    uint32_t *max;
+    uint32_t *matches;
+    uint32_t *match_slots;
+    uint32_t *optimal_bits;
+    uint16_t *optimal_offset;
+    uint16_t *optimal_len;
+    ZX7MatchBack match_back;
+    uint32_t *match;
     int match_index;
     int offset;
     size_t len;
     size_t best_len;
+    size_t limit;
+    size_t match_bits;
     size_t bits;
     size_t i;
+#ifdef ZX7_PROFILE
+    size_t known;
+    uint64_t tried;
+#endif
 
-    /* allocate all data structures at once */
-    min = (size_t *)calloc(MAX_OFFSET+1, sizeof(size_t));
-    max = (size_t *)calloc(MAX_OFFSET+1, sizeof(size_t));
-    matches = (size_t *)calloc(256*256, sizeof(size_t));
-    match_slots = (size_t *)calloc(input_size, sizeof(size_t));
-    optimal = (Optimal *)calloc(input_size, sizeof(Optimal));
-
-    if (!min || !max || !matches || !match_slots || !optimal) {
-         fprintf(stderr, "Error: Insufficient memory\n");
-         exit(1);
+    /* reuse the context workspace, growing it only for a larger input */
+    if (zx7_reserve(ctx, input_size) != ZX7_OK) {
+         return ZX7_ERR_MEMORY;
     }
+    min = ctx->min;
+    max = ctx->max;
+    matches = ctx->matches;
+    match_slots = ctx->match_slots;
+    optimal_bits = ctx->optimal_bits;
+    optimal_offset = ctx->optimal_offset;
+    optimal_len = ctx->optimal_len;
+    match_back = ctx->match_back;
+
+    /* match_slots and the parse are written before being read, only the
+       offset tables need to start from zero */
+    memset(min, 0, (MAX_OFFSET+1)*sizeof(uint32_t));
+    memset(max, 0, (MAX_OFFSET+1)*sizeof(uint32_t));
 
     /* index skipped bytes */
     for (i = 1; i <= (size_t)skip; i++) {
@@ -77,49 +92,88 @@ Optimal* optimize(unsigned char *input_data, size_t input_size, long skip) {
     }
 
     /* first byte is always literal */
-    optimal[skip].bits = 8;
+    optimal_bits[skip] = 8;
+    optimal_offset[skip] = 0;
+    optimal_len[skip] = 0;
 
     /* process remaining bytes */
     for (; i < input_size; i++) {
 
-        optimal[i].bits = optimal[i-1].bits + 9;
+        optimal_bits[i] = optimal_bits[i-1] + 9;
+        optimal_offset[i] = 0;
+        optimal_len[i] = 0;
         match_index = input_data[i-1] << 8 | input_data[i];
         best_len = 1;
+        ZX7_PROFILE_ONLY(tried = 0;)
         for (match = &matches[match_index]; *match != 0 && best_len < MAX_LEN; match = &match_slots[*match]) {
             offset = i - *match;
             if (offset > MAX_OFFSET) {
+                ZX7_COUNT(ctx, window_cuts, 1);
                 *match = 0;
                 break;
             }
+            ZX7_PROFILE_ONLY(tried++;)
+
+            /* longest match that could be used here */
+            limit = *match + 1;
+            if (limit > MAX_LEN) {
+                limit = MAX_LEN;
+            }
+            if (limit > i-skip) {
+                limit = i-skip;
+            }
+
+            /* the last two bytes match by construction; when this offset also
+               matched at the previous position, all of that match still does */
+            len = 2;
+            if (max[offset] != 0 && max[offset] == i-1 && i+1-min[offset] > len) {
+                len = i+1-min[offset];
+            }
+            if (len > limit) {
+                len = limit;
+            }
+            /* most candidates stop at the next byte, only call out for the rest */
+            ZX7_PROFILE_ONLY(known = len;)
+            if (len < limit && input_data[i-len] == input_data[*match-len]) {
+                len = match_back(input_data+i, input_data+*match, len+1, limit);
+            }
+            ZX7_COUNT(ctx, compared, len - known + (len < limit));
 
-            for (len = 2; len <= MAX_LEN && i >= skip+len; len++) {
-                if (len > best_len) {
-                    best_len = len;
-                    bits = optimal[i-len].bits + count_bits(offset, len);
-                    if (optimal[i].bits > bits) {
-                        optimal[i].bits = bits;
-                        optimal[i].offset = offset;
-                        optimal[i].len = len;
+            /* price the lengths no nearer offset reached; the gamma code of
+               len-1 only grows at powers of two, so its size is carried along */
+            if (best_len < len) {
+                match_bits = count_bits(offset, best_len+1);
+                for (;;) {
+                    best_len++;
+                    bits = optimal_bits[i-best_len] + match_bits;
+                    if (optimal_bits[i] > bits) {
+                        optimal_bits[i] = bits;
+                        optimal_offset[i] = offset;
+                        optimal_len[i] = best_len-1;
                     }
-                } else if (max[offset] != 0 && i+1 == max[offset]+len) {
-                    len = i-min[offset];
-                    if (len > best_len) {
-                        len = best_len;
+                    if (best_len == len) {
+                        break;
+                    }
+                    if ((best_len & (best_len-1)) == 0) {
+                        match_bits += 2;
                     }
-                }
-                if (i < offset+len || input_data[i-len] != input_data[i-len-offset]) {
-                    break;
                 }
             }
             min[offset] = i+1-len;
             max[offset] = i;
         }
+        ZX7_COUNT(ctx, positions, 1);
+        ZX7_COUNT(ctx, candidates, tried);
+        ZX7_PROFILE_ONLY(zx7_profile_search(&ctx->profile, tried);)
         match_slots[i] = matches[match_index];
         matches[match_index] = i;
     }
 
-    /* save time by releasing the largest block only, the O.S. will clean everything else later */
-    free(match_slots);
+    /* leave the hash table empty for the next input by clearing only the
+       buckets this input used, instead of all 64K of them */
+    for (i = 1; i < input_size; i++) {
+        matches[input_data[i-1] << 8 | input_data[i]] = 0;
+    }
 
-    return optimal;
+    return ZX7_OK;
 }
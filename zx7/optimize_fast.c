@@ -0,0 +1,154 @@
+/*
+ * (c) Copyright 2012-2016 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "zx7.h"
+
+/* candidates looked at per position, bounding the fast levels to linear time */
+#define FAST_CHAIN_DEPTH 32
+
+/*
+ * Greedy and lazy parsing for the fast compression levels. The parse is
+ * written into the same arrays optimize() fills, so compress() and the
+ * stream format are unchanged; only the positions on the chosen path are
+ * set, which is all compress() reads.
+ *
+ * Matches are found forwards with the same two-byte hash chains as
+ * optimize(): node q stands for the string starting at q-1, so the
+ * tables are shared and cleared the same way. Chains are walked nearest
+ * first and only FAST_CHAIN_DEPTH deep.
+ */
+
+typedef struct {
+    size_t len;
+    size_t offset;
+} Match;
+
+static Match longest_match(const uint32_t *matches, const uint32_t *match_slots, const unsigned char *input_data,
+                           size_t input_size, size_t p) {
+    Match best;
+    size_t limit;
+    size_t len;
+    size_t depth;
+    size_t q;
+
+    best.len = 0;
+    best.offset = 0;
+    if (p+1 >= input_size) {
+        return best;
+    }
+    limit = input_size-p < MAX_LEN ? input_size-p : MAX_LEN;
+    for (q = matches[input_data[p] << 8 | input_data[p+1]], depth = FAST_CHAIN_DEPTH; q != 0 && depth > 0;
+         q = match_slots[q], depth--) {
+        if (p+1-q > MAX_OFFSET) {
+            break;
+        }
+        for (len = 2; len < limit && input_data[p+len] == input_data[q-1+len]; len++) {
+        }
+        if (len > best.len) {
+            best.len = len;
+            best.offset = p+1-q;
+            if (len == limit) {
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+int optimize_fast(ZX7Context *ctx, const unsigned char *input_data, size_t input_size, long skip, int lazy) {
+    uint32_t *matches;
+    uint32_t *match_slots;
+    uint32_t *optimal_bits;
+    uint16_t *optimal_offset;
+    uint16_t *optimal_len;
+    Match match;
+    Match next;
+    size_t inserted;
+    size_t match_index;
+    size_t p;
+    size_t i;
+
+    if (zx7_reserve(ctx, input_size) != ZX7_OK) {
+         return ZX7_ERR_MEMORY;
+    }
+    matches = ctx->matches;
+    match_slots = ctx->match_slots;
+    optimal_bits = ctx->optimal_bits;
+    optimal_offset = ctx->optimal_offset;
+    optimal_len = ctx->optimal_len;
+
+    /* first byte is always literal */
+    optimal_bits[skip] = 8;
+    optimal_offset[skip] = 0;
+    optimal_len[skip] = 0;
+
+    /* positions before p are indexed before searching at p; the last byte
+       starts no two-byte string */
+    inserted = 1;
+    for (p = skip+1; p < input_size; ) {
+        for (; inserted <= p && inserted < input_size; inserted++) {
+            match_index = input_data[inserted-1] << 8 | input_data[inserted];
+            match_slots[inserted] = matches[match_index];
+            matches[match_index] = inserted;
+        }
+        match = longest_match(matches, match_slots, input_data, input_size, p);
+
+        /* lazy: a literal first if the next position has a longer match that
+           is cheaper per byte, literal included */
+        if (lazy && match.len >= 2 && p+1 < input_size) {
+            if (inserted == p+1 && inserted < input_size) {
+                match_index = input_data[inserted-1] << 8 | input_data[inserted];
+                match_slots[inserted] = matches[match_index];
+                matches[match_index] = inserted;
+                inserted++;
+            }
+            next = longest_match(matches, match_slots, input_data, input_size, p+1);
+            if (next.len > match.len &&
+                (9 + count_bits(next.offset, next.len)) * match.len < count_bits(match.offset, match.len) * (next.len+1)) {
+                match.len = 0;
+            }
+        }
+
+        if (match.len < 2) {
+            optimal_bits[p] = optimal_bits[p-1] + 9;
+            optimal_offset[p] = 0;
+            optimal_len[p] = 0;
+            p++;
+        } else {
+            i = p + match.len - 1;
+            optimal_bits[i] = optimal_bits[p-1] + count_bits(match.offset, match.len);
+            optimal_offset[i] = match.offset;
+            optimal_len[i] = match.len-1;
+            p += match.len;
+        }
+    }
+
+    /* leave the hash table empty for the next input */
+    for (i = 1; i < inserted; i++) {
+        matches[input_data[i-1] << 8 | input_data[i]] = 0;
+    }
+
+    return ZX7_OK;
+}
@@ -0,0 +1,169 @@
+/*
+ * (c) Copyright 2012-2016 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include "zx7.h"
+
+/*
+ * optimize() with a cost that also counts decoding time: every token costs
+ * its bits plus ctx->speed/ZX7_SPEED_ONE bits per T-state that
+ * dzx7_standard spends on it (see count_t8()). Costs are kept in 64 bits in
+ * units of 1/(8*ZX7_SPEED_ONE) bit, so the weight is exact.
+ *
+ * A nearer offset never costs more bits or more time than a farther one
+ * for the same length, so the hash chains are walked exactly as optimize()
+ * does. At the end optimal_bits holds the real size of the parse at
+ * input_size-1, which is all compress() needs.
+ */
+
+#define BIT_COST  ((uint64_t)8*ZX7_SPEED_ONE)
+
+int optimize_speed(ZX7Context *ctx, const unsigned char *input_data, size_t input_size, long skip) {
+    uint32_t *min;
+    uint32_t *max;
+    uint32_t *matches;
+    uint32_t *match_slots;
+    uint64_t *optimal_cost;
+    uint16_t *optimal_offset;
+    uint16_t *optimal_len;
+    ZX7MatchBack match_back;
+    uint64_t weight;
+    uint64_t literal_cost;
+    uint64_t cost;
+    uint64_t bits;
+    uint32_t *match;
+    int match_index;
+    int offset;
+    size_t len;
+    size_t best_len;
+    size_t limit;
+    size_t i;
+#ifdef ZX7_PROFILE
+    size_t known;
+    uint64_t tried;
+#endif
+
+    if (zx7_reserve(ctx, input_size) != ZX7_OK) {
+         return ZX7_ERR_MEMORY;
+    }
+    min = ctx->min;
+    max = ctx->max;
+    matches = ctx->matches;
+    match_slots = ctx->match_slots;
+    optimal_cost = ctx->optimal_cost;
+    optimal_offset = ctx->optimal_offset;
+    optimal_len = ctx->optimal_len;
+    match_back = ctx->match_back;
+    weight = ctx->speed;
+    literal_cost = 9*BIT_COST + weight*count_t8(0, 1);
+
+    memset(min, 0, (MAX_OFFSET+1)*sizeof(uint32_t));
+    memset(max, 0, (MAX_OFFSET+1)*sizeof(uint32_t));
+
+    /* index skipped bytes */
+    for (i = 1; i <= (size_t)skip; i++) {
+        match_index = input_data[i-1] << 8 | input_data[i];
+        match_slots[i] = matches[match_index];
+        matches[match_index] = i;
+    }
+
+    /* first byte is always literal */
+    optimal_cost[skip] = 8*BIT_COST;
+    optimal_offset[skip] = 0;
+    optimal_len[skip] = 0;
+
+    /* process remaining bytes */
+    for (; i < input_size; i++) {
+
+        optimal_cost[i] = optimal_cost[i-1] + literal_cost;
+        optimal_offset[i] = 0;
+        optimal_len[i] = 0;
+        match_index = input_data[i-1] << 8 | input_data[i];
+        best_len = 1;
+        ZX7_PROFILE_ONLY(tried = 0;)
+        for (match = &matches[match_index]; *match != 0 && best_len < MAX_LEN; match = &match_slots[*match]) {
+            offset = i - *match;
+            if (offset > MAX_OFFSET) {
+                ZX7_COUNT(ctx, window_cuts, 1);
+                *match = 0;
+                break;
+            }
+            ZX7_PROFILE_ONLY(tried++;)
+
+            limit = *match + 1;
+            if (limit > MAX_LEN) {
+                limit = MAX_LEN;
+            }
+            if (limit > i-skip) {
+                limit = i-skip;
+            }
+
+            len = 2;
+            if (max[offset] != 0 && max[offset] == i-1 && i+1-min[offset] > len) {
+                len = i+1-min[offset];
+            }
+            if (len > limit) {
+                len = limit;
+            }
+            ZX7_PROFILE_ONLY(known = len;)
+            if (len < limit && input_data[i-len] == input_data[*match-len]) {
+                len = match_back(input_data+i, input_data+*match, len+1, limit);
+            }
+            ZX7_COUNT(ctx, compared, len - known + (len < limit));
+
+            /* price the lengths no nearer offset reached */
+            while (best_len < len) {
+                best_len++;
+                cost = optimal_cost[i-best_len] + BIT_COST*count_bits(offset, best_len) + weight*count_t8(offset, best_len);
+                if (optimal_cost[i] > cost) {
+                    optimal_cost[i] = cost;
+                    optimal_offset[i] = offset;
+                    optimal_len[i] = best_len-1;
+                }
+            }
+            min[offset] = i+1-len;
+            max[offset] = i;
+        }
+        ZX7_COUNT(ctx, positions, 1);
+        ZX7_COUNT(ctx, candidates, tried);
+        ZX7_PROFILE_ONLY(zx7_profile_search(&ctx->profile, tried);)
+        match_slots[i] = matches[match_index];
+        matches[match_index] = i;
+    }
+
+    for (i = 1; i < input_size; i++) {
+        matches[input_data[i-1] << 8 | input_data[i]] = 0;
+    }
+
+    /* size of the chosen parse, for compress() */
+    bits = 8;
+    for (i = input_size-1; i != (size_t)skip; i -= optimal_len[i]+1) {
+        bits += optimal_offset[i] ? (uint64_t)count_bits(optimal_offset[i], optimal_len[i]+1) : 9;
+    }
+    ctx->optimal_bits[input_size-1] = (uint32_t)bits;
+
+    return ZX7_OK;
+}
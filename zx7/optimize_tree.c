@@ -0,0 +1,242 @@
+/*
+ * (c) Copyright 2012-2016 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include "zx7.h"
+
+/*
+ * Same parse as optimize(), with the matches found by a binary tree instead
+ * of hash chains.
+ *
+ * Every position is a node keyed by the string read backwards from it, at
+ * most MAX_LEN bytes. The newest position is always the root and each
+ * search walks down towards older positions, so offsets only grow along
+ * the path and the walk stops at the first node beyond MAX_OFFSET. The
+ * longest match seen so far only grows along the path too, and each time
+ * it does the node is the nearest one with that length: exactly the
+ * (offset, length) pairs the hash chains would have evaluated.
+ *
+ * Long runs are what make the hash chains slow, since every offset in the
+ * window shares the same two bytes and gets compared again at every
+ * position. Here the match length at an offset is remembered, so when the
+ * same offset comes up at the next position it costs a single comparison.
+ *
+ * Long matches are also slow to price one length at a time. All lengths
+ * with the same offset and the same Elias-gamma size cost the same extra
+ * bits, so only the cheapest position they can start from matters, and a
+ * sparse table over the parse finds it with two lookups.
+ */
+
+/* the cheaper of two positions; on a tie the later one, i.e. the shorter match */
+static uint32_t cheaper(const uint32_t *bits, uint32_t a, uint32_t b) {
+    if (bits[a] != bits[b]) {
+        return bits[a] < bits[b] ? a : b;
+    }
+    return a > b ? a : b;
+}
+
+/* adds the final cost of position p to the sparse table, level k holds the
+   cheapest position of every run of 2^k starting at or after skip */
+static void table_append(uint32_t *table, size_t stride, size_t levels, const uint32_t *bits, size_t skip, size_t p) {
+    size_t half;
+    size_t k;
+
+    table[p] = p;
+    for (k = 1, half = 1; k < levels && p+1 >= skip + 2*half; k++, half *= 2) {
+        table[k*stride + p+1-2*half] = cheaper(bits, table[(k-1)*stride + p+1-2*half],
+                                               table[(k-1)*stride + p+1-half]);
+    }
+}
+
+/* cheapest position in first..last */
+static size_t table_query(const uint32_t *table, size_t stride, const uint32_t *bits, size_t first, size_t last) {
+    size_t span;
+    size_t k;
+
+    for (k = 0, span = 1; span*2 <= last-first+1; k++, span *= 2) {
+    }
+    return cheaper(bits, table[k*stride + first], table[k*stride + last+1-span]);
+}
+
+int optimize_tree(ZX7Context *ctx, const unsigned char *input_data, size_t input_size, long skip) {
+    uint32_t *left;
+    uint32_t *right;
+    uint32_t *last_pos;
+    uint32_t *last_len;
+    uint32_t *table;
+    size_t stride;
+    size_t levels;
+    uint32_t *optimal_bits;
+    uint16_t *optimal_offset;
+    uint16_t *optimal_len;
+    ZX7MatchBack match_back;
+    uint32_t *left_ptr;
+    uint32_t *right_ptr;
+    size_t left_len;
+    size_t right_len;
+    size_t offset;
+    size_t len;
+    size_t best_len;
+    size_t max_len;
+    size_t limit;
+    size_t first;
+    size_t last;
+    size_t bucket;
+    size_t start;
+    size_t bits;
+    size_t i;
+    size_t j;
+#ifdef ZX7_PROFILE
+    size_t known;
+    uint64_t tried;
+#endif
+
+    if (zx7_reserve(ctx, input_size) != ZX7_OK) {
+         return ZX7_ERR_MEMORY;
+    }
+    left = ctx->tree_left;
+    right = ctx->tree_right;
+    last_pos = ctx->tree_pos;
+    last_len = ctx->tree_len;
+    table = ctx->tree_min;
+    stride = ctx->tree_capacity;
+    levels = zx7_tree_levels(stride);
+    optimal_bits = ctx->optimal_bits;
+    optimal_offset = ctx->optimal_offset;
+    optimal_len = ctx->optimal_len;
+    match_back = ctx->match_back;
+
+    /* the tree is rebuilt from scratch, only the per-offset memory needs
+       clearing so that nothing from a previous input looks recent */
+    memset(last_pos, 0, (MAX_OFFSET+1)*sizeof(uint32_t));
+
+    /* first byte is always literal */
+    optimal_bits[skip] = 8;
+    optimal_offset[skip] = 0;
+    optimal_len[skip] = 0;
+    table_append(table, stride, levels, optimal_bits, skip, skip);
+
+    /* skipped bytes are inserted too, but not parsed */
+    for (i = 1; i < input_size; i++) {
+
+        if (i > (size_t)skip) {
+            optimal_bits[i] = optimal_bits[i-1] + 9;
+            optimal_offset[i] = 0;
+            optimal_len[i] = 0;
+            max_len = i-skip;
+        } else {
+            max_len = 0;
+        }
+
+        left_ptr = &left[i];
+        right_ptr = &right[i];
+        left_len = right_len = 0;
+        best_len = 1;
+        ZX7_PROFILE_ONLY(tried = 0;)
+        for (j = i-1; j != 0 && i-j <= MAX_OFFSET; ) {
+            offset = i-j;
+            ZX7_PROFILE_ONLY(tried++;)
+
+            /* extend the match at this offset from the previous position if
+               it was compared there, otherwise from what both sides of the
+               path already have in common */
+            if (last_pos[offset] == i-1) {
+                len = input_data[i] == input_data[j] ? last_len[offset]+1 : 0;
+                if (len > MAX_LEN) {
+                    len = MAX_LEN;
+                }
+                ZX7_COUNT(ctx, compared, 1);
+            } else {
+                len = left_len < right_len ? left_len : right_len;
+                limit = j+1 < MAX_LEN ? j+1 : MAX_LEN;
+                ZX7_PROFILE_ONLY(known = len;)
+                if (len < limit && input_data[i-len] == input_data[j-len]) {
+                    len = match_back(input_data+i, input_data+j, len+1, limit);
+                }
+                ZX7_COUNT(ctx, compared, len - known + (len < limit));
+            }
+            last_pos[offset] = i;
+            last_len[offset] = len;
+
+            /* nearest match for every length not seen at a smaller offset,
+               priced one gamma size at a time in order of length */
+            if (len > best_len) {
+                for (first = best_len+1; first <= len && first <= max_len; first = last+1) {
+                    for (bucket = 1; bucket*2 <= first-1; bucket *= 2) {
+                    }
+                    last = 2*bucket;
+                    if (last > len) {
+                        last = len;
+                    }
+                    if (last > max_len) {
+                        last = max_len;
+                    }
+                    start = table_query(table, stride, optimal_bits, i-last, i-first);
+                    bits = optimal_bits[start] + count_bits(offset, first);
+                    if (optimal_bits[i] > bits) {
+                        optimal_bits[i] = bits;
+                        optimal_offset[i] = offset;
+                        optimal_len[i] = i-start-1;
+                    }
+                }
+                best_len = len;
+            }
+
+            /* as long as any key can be: the new node takes the old one's place */
+            if (len == MAX_LEN) {
+                *left_ptr = left[j];
+                *right_ptr = right[j];
+                break;
+            }
+
+            /* a string that ran out first sorts before the ones extending it */
+            if (len == j+1 || input_data[j-len] < input_data[i-len]) {
+                *left_ptr = j;
+                left_ptr = &right[j];
+                left_len = len;
+                j = right[j];
+            } else {
+                *right_ptr = j;
+                right_ptr = &left[j];
+                right_len = len;
+                j = left[j];
+            }
+        }
+        if (j == 0 || i-j > MAX_OFFSET) {
+            *left_ptr = *right_ptr = 0;
+        }
+        ZX7_COUNT(ctx, window_cuts, j != 0 && i-j > MAX_OFFSET);
+        ZX7_COUNT(ctx, positions, 1);
+        ZX7_COUNT(ctx, candidates, tried);
+        ZX7_PROFILE_ONLY(zx7_profile_search(&ctx->profile, tried);)
+
+        if (i > (size_t)skip) {
+            table_append(table, stride, levels, optimal_bits, skip, i);
+        }
+    }
+
+    return ZX7_OK;
+}
@@ -0,0 +1,187 @@
+/*
+ * (c) Copyright 2012-2016 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "zx7.h"
+
+/*
+ * Timing of dzx7_standard (asm/dzx7_standard.asm), the decoder the optimal
+ * parse prices for. Apart from its next-bit routine every path through it has a fixed
+ * cost. That routine takes 15 T-states, plus 21 when it has to refill its bit
+ * buffer, which it does on the first bit and then on every 8th. Spread over
+ * the bits, a bit read costs 15 + 21/8, so token costs are kept in eighths of
+ * a T-state:
+ *
+ *   literal   CALL, JR taken, LDI                          45     + 1 bit
+ *   match     flag, Elias gamma of len-1 with n+1 leading
+ *             bits, offset byte, LDIR of len bytes   228 + 89n + 21len
+ *             offset 1..128                                12
+ *             offset 129..2176                            169     + 4 bits
+ *                                                                 + 2n+2 bits
+ */
+
+#define BIT_T8   (8*15 + 21)
+
+int count_t8(int offset, int len) {
+    int n;
+
+    if (offset == 0) {
+        return 8*45 + BIT_T8;
+    }
+    for (n = 0; (len-1) >> (n+1) != 0; n++) {
+    }
+    return 8*(228 + 89*n + 21*len) + BIT_T8*(2*n+2) + (offset > 128 ? 8*169 + 4*BIT_T8 : 8*12);
+}
+
+/*
+ * Whole-stream timing of the three decoders the loaders can embed
+ * (asm/dzx7_*.asm). A bit read costs `bit`, plus `refill` when it reloads the
+ * bit buffer. The mega decoder refills in blocks that branch straight back,
+ * which is cheaper for a 0 at the literal/match flag or in the gamma length
+ * prefix (refill_zero). Token costs exclude their bits:
+ *
+ *                    standard   turbo   mega
+ *   first literal          23      23     23
+ *   literal                45      28     28
+ *   match                 228     169    154   + per_n*n + 21len
+ *     per_n                89      55     55
+ *     len 2                 0       0     10
+ *     offset 1..128        12      12     12
+ *     offset 129..2176    169      47     47   (46 if the 4th extra bit is 1)
+ *   end marker           1556     985    943   + end_bits after its 16 zeros
+ */
+typedef struct {
+    int bit;
+    int refill;
+    int refill_zero;
+    int literal;
+    int match;
+    int per_n;
+    int len2;
+    int short_offset;
+    int long_offset;
+    int long_one;       /* added when the 4th extra offset bit is 1 */
+    int end;
+    int end_bits;
+} DZX7Timing;
+
+static const DZX7Timing timings[] = {
+    /* ZX7_DZX7_STANDARD */ { 15, 21, 21, 45, 228, 89,  0, 12, 169,  0, 1556, 18 },
+    /* ZX7_DZX7_TURBO */    { 14, 34, 34, 28, 169, 55,  0, 12,  47, -1,  985, 17 },
+    /* ZX7_DZX7_MEGA */     { 11, 34, 22, 28, 154, 55, 10, 12,  47, -1,  943, 17 },
+};
+
+typedef struct {
+    const DZX7Timing *t;
+    const unsigned char *data;
+    size_t size;
+    size_t index;
+    int mask;
+    int value;
+    uint64_t total;
+} Walk;
+
+/* reads one bit the way the decoder does and charges it; test is set at the
+   flag and gamma length prefix, where mega's refill blocks take a 0 cheaper */
+static int next_bit(Walk *w, int test) {
+    int refill = 0;
+    int bit;
+
+    if (w->mask == 0) {
+        w->value = w->index < w->size ? w->data[w->index] : 0;
+        w->index++;
+        w->mask = 128;
+        refill = 1;
+    }
+    bit = (w->value & w->mask) != 0;
+    w->mask >>= 1;
+    w->total += w->t->bit;
+    if (refill) {
+        w->total += test && !bit ? w->t->refill_zero : w->t->refill;
+    }
+    return bit;
+}
+
+uint64_t zx7_tstates(const unsigned char *data, size_t size, int decoder) {
+    Walk w;
+    size_t len;
+    int n;
+    int i;
+
+    if (size == 0 || decoder < 0 || decoder > ZX7_DZX7_MEGA) {
+        return 0;
+    }
+    w.t = &timings[decoder];
+    w.data = data;
+    w.size = size;
+    w.mask = 0;
+    w.value = 0;
+
+    /* LD A,$80 and the LDI of the first literal */
+    w.total = 7 + 16;
+    w.index = 1;
+    for (;;) {
+        if (w.index > size) {
+            return 0;
+        }
+        if (!next_bit(&w, 1)) {
+            w.total += w.t->literal;
+            w.index++;
+            continue;
+        }
+
+        /* Elias gamma of len-1; 16 leading zeros is the end marker */
+        for (n = 0; n < 16 && !next_bit(&w, 1); n++) {
+        }
+        if (n == 16) {
+            break;
+        }
+        len = 1;
+        for (i = 0; i < n; i++) {
+            len = len << 1 | next_bit(&w, 0);
+        }
+        len++;
+
+        /* the offset byte, and 4 more bits for a long offset */
+        if (w.index >= size) {
+            return 0;
+        }
+        if (data[w.index++] & 128) {
+            for (i = 0; i < 3; i++) {
+                next_bit(&w, 0);
+            }
+            w.total += w.t->long_offset + (next_bit(&w, 0) ? w.t->long_one : 0);
+        } else {
+            w.total += w.t->short_offset;
+        }
+        w.total += w.t->match + w.t->per_n*n + 21*len + (n == 0 ? w.t->len2 : 0);
+    }
+
+    /* the end marker: the 1 after its 16 zeros and 16 more bits to overflow
+       BC; the standard decoder then exits through its next-bit routine */
+    for (i = 0; i < w.t->end_bits; i++) {
+        next_bit(&w, i == 0);
+    }
+    return w.total + w.t->end;
+}
@@ -0,0 +1,287 @@
+/*
+ * (c) Copyright 2012-2016 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+
+#include "zx7.h"
+
+ZX7Context *zx7_create(void) {
+    ZX7Context *ctx;
+
+    ctx = (ZX7Context *)calloc(1, sizeof(ZX7Context));
+    if (ctx) {
+        ctx->match_back = zx7_match_back();
+    }
+    return ctx;
+}
+
+static void account(ZX7Context *ctx, size_t released, size_t acquired) {
+    ctx->allocated_bytes = ctx->allocated_bytes - released + acquired;
+    if (ctx->allocated_bytes > ctx->peak_bytes) {
+        ctx->peak_bytes = ctx->allocated_bytes;
+    }
+}
+
+int zx7_profiling(void) {
+#ifdef ZX7_PROFILE
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/* index of the highest set bit, 0 for 0 and 1 */
+static int log2_floor(uint64_t value) {
+    int bits;
+
+    for (bits = 0; value > 1; value >>= 1) {
+        bits++;
+    }
+    return bits;
+}
+
+void zx7_profile_search(ZX7Profile *profile, uint64_t candidates) {
+    int bucket;
+
+    if (candidates > profile->longest_search) {
+        profile->longest_search = candidates;
+    }
+    bucket = candidates ? 1 + log2_floor(candidates) : 0;
+    if (bucket >= ZX7_SEARCH_BUCKETS) {
+        bucket = ZX7_SEARCH_BUCKETS-1;
+    }
+    profile->search_hist[bucket]++;
+}
+
+void zx7_profile_match(ZX7Profile *profile, int offset, int len) {
+    int bucket;
+
+    profile->matches++;
+    if (offset > 128) {
+        profile->long_offsets++;
+    }
+    profile->len_hist[log2_floor(len-1)]++;
+    bucket = log2_floor(offset);
+    profile->offset_hist[bucket < ZX7_OFFSET_BUCKETS ? bucket : ZX7_OFFSET_BUCKETS-1]++;
+}
+
+void zx7_profile_add(ZX7Profile *total, const ZX7Profile *part) {
+    int i;
+
+    total->positions += part->positions;
+    total->candidates += part->candidates;
+    if (part->longest_search > total->longest_search) {
+        total->longest_search = part->longest_search;
+    }
+    total->compared += part->compared;
+    total->window_cuts += part->window_cuts;
+    for (i = 0; i < ZX7_SEARCH_BUCKETS; i++) {
+        total->search_hist[i] += part->search_hist[i];
+    }
+    total->literals += part->literals;
+    total->matches += part->matches;
+    total->long_offsets += part->long_offsets;
+    for (i = 0; i < ZX7_LEN_BUCKETS; i++) {
+        total->len_hist[i] += part->len_hist[i];
+    }
+    for (i = 0; i < ZX7_OFFSET_BUCKETS; i++) {
+        total->offset_hist[i] += part->offset_hist[i];
+    }
+}
+
+size_t zx7_tree_levels(size_t input_size) {
+    size_t levels;
+
+    /* no range priced at once is longer than MAX_LEN/2 */
+    for (levels = 1; ((size_t)1 << levels) <= input_size && ((size_t)2 << levels) <= MAX_LEN; levels++) {
+    }
+    return levels;
+}
+
+/* grows *buffer from old_count to new_count elements, optionally zeroing it */
+static int grow(ZX7Context *ctx, void **buffer, size_t old_count, size_t new_count, size_t size, int zero) {
+    void *data;
+
+    data = zero ? calloc(new_count, size) : realloc(*buffer, new_count*size);
+    if (!data) {
+        return ZX7_ERR_MEMORY;
+    }
+    if (zero) {
+        free(*buffer);
+    }
+    *buffer = data;
+    account(ctx, old_count*size, new_count*size);
+    return ZX7_OK;
+}
+
+int zx7_reserve(ZX7Context *ctx, size_t input_size) {
+    int ok = ZX7_OK;
+
+    if (input_size > ZX7_MAX_INPUT) {
+        return ZX7_ERR_INPUT;
+    }
+
+    /* per-byte parse, grown to the largest input seen so far */
+    if (input_size > ctx->capacity) {
+        ok |= grow(ctx, (void **)&ctx->optimal_bits, ctx->capacity, input_size, sizeof(uint32_t), 0);
+        ok |= grow(ctx, (void **)&ctx->optimal_offset, ctx->capacity, input_size, sizeof(uint16_t), 0);
+        ok |= grow(ctx, (void **)&ctx->optimal_len, ctx->capacity, input_size, sizeof(uint16_t), 0);
+        if (ok == ZX7_OK) {
+            ctx->capacity = input_size;
+        }
+    }
+
+    /* the speed weighted parse has its own costs */
+    if (ctx->parse == ZX7_PARSE_OPTIMAL && ctx->speed && input_size > ctx->cost_capacity) {
+        ok |= grow(ctx, (void **)&ctx->optimal_cost, ctx->cost_capacity, input_size, sizeof(uint64_t), 0);
+        if (ok == ZX7_OK) {
+            ctx->cost_capacity = input_size;
+        }
+    }
+
+    /* only the selected match finder gets its tables, the fast parsers and
+       the speed weighted parse share the hash chains */
+    if (ctx->parse == ZX7_PARSE_OPTIMAL && ctx->match_finder == ZX7_MATCH_TREE && !ctx->speed) {
+        if (!ctx->tree_pos) {
+            ok |= grow(ctx, (void **)&ctx->tree_pos, 0, MAX_OFFSET+1, sizeof(uint32_t), 1);
+            ok |= grow(ctx, (void **)&ctx->tree_len, 0, MAX_OFFSET+1, sizeof(uint32_t), 1);
+        }
+        if (input_size > ctx->tree_capacity) {
+            ok |= grow(ctx, (void **)&ctx->tree_left, ctx->tree_capacity, input_size, sizeof(uint32_t), 0);
+            ok |= grow(ctx, (void **)&ctx->tree_right, ctx->tree_capacity, input_size, sizeof(uint32_t), 0);
+            ok |= grow(ctx, (void **)&ctx->tree_min, ctx->tree_capacity*zx7_tree_levels(ctx->tree_capacity),
+                       input_size*zx7_tree_levels(input_size), sizeof(uint32_t), 0);
+            if (ok == ZX7_OK) {
+                ctx->tree_capacity = input_size;
+            }
+        }
+    } else {
+        /* fixed-size tables, allocated once; matches must start out empty */
+        if (!ctx->matches) {
+            ok |= grow(ctx, (void **)&ctx->min, 0, MAX_OFFSET+1, sizeof(uint32_t), 0);
+            ok |= grow(ctx, (void **)&ctx->max, 0, MAX_OFFSET+1, sizeof(uint32_t), 0);
+            ok |= grow(ctx, (void **)&ctx->matches, 0, 256*256, sizeof(uint32_t), 1);
+        }
+        if (input_size > ctx->hash_capacity) {
+            ok |= grow(ctx, (void **)&ctx->match_slots, ctx->hash_capacity, input_size, sizeof(uint32_t), 0);
+            if (ok == ZX7_OK) {
+                ctx->hash_capacity = input_size;
+            }
+        }
+    }
+    if (ok != ZX7_OK) {
+        zx7_release(ctx);
+        return ZX7_ERR_MEMORY;
+    }
+
+    /* worst case output is all literals: 9 bits per byte plus the end marker */
+    return zx7_reserve_output(ctx, input_size + input_size/8 + 4);
+}
+
+int zx7_reserve_output(ZX7Context *ctx, size_t output_size) {
+    unsigned char *output_data;
+
+    if (output_size > ctx->output_capacity) {
+        output_data = (unsigned char *)realloc(ctx->output_data, output_size);
+        if (!output_data) {
+            return ZX7_ERR_MEMORY;
+        }
+        account(ctx, ctx->output_capacity, output_size);
+        ctx->output_data = output_data;
+        ctx->output_capacity = output_size;
+    }
+    return ZX7_OK;
+}
+
+void zx7_release(ZX7Context *ctx) {
+    free(ctx->optimal_bits);
+    free(ctx->optimal_offset);
+    free(ctx->optimal_len);
+    free(ctx->optimal_cost);
+    free(ctx->min);
+    free(ctx->max);
+    free(ctx->matches);
+    free(ctx->match_slots);
+    free(ctx->tree_left);
+    free(ctx->tree_right);
+    free(ctx->tree_pos);
+    free(ctx->tree_len);
+    free(ctx->tree_min);
+    ctx->optimal_bits = NULL;
+    ctx->optimal_offset = ctx->optimal_len = NULL;
+    ctx->optimal_cost = NULL;
+    ctx->min = ctx->max = ctx->matches = ctx->match_slots = NULL;
+    ctx->tree_left = ctx->tree_right = ctx->tree_pos = ctx->tree_len = ctx->tree_min = NULL;
+    ctx->capacity = ctx->cost_capacity = ctx->hash_capacity = ctx->tree_capacity = 0;
+    ctx->allocated_bytes = ctx->output_capacity;
+}
+
+int zx7_parse(ZX7Context *ctx, const unsigned char *input_data, size_t input_size, long skip) {
+    if (!ctx || !input_data || input_size == 0 || input_size > ZX7_MAX_INPUT || skip < 0 || (size_t)skip >= input_size) {
+        return ZX7_ERR_INPUT;
+    }
+
+    if (ctx->parse != ZX7_PARSE_OPTIMAL) {
+        return optimize_fast(ctx, input_data, input_size, skip, ctx->parse == ZX7_PARSE_LAZY);
+    } else if (ctx->speed) {
+        return optimize_speed(ctx, input_data, input_size, skip);
+    } else if (ctx->match_finder == ZX7_MATCH_TREE) {
+        return optimize_tree(ctx, input_data, input_size, skip);
+    }
+    return optimize(ctx, input_data, input_size, skip);
+}
+
+int zx7_write(ZX7Context *ctx, const unsigned char *input_data, size_t input_size, long skip, unsigned char **output_data, size_t *output_size, long *delta) {
+    int result;
+
+    if (!ctx || !input_data || input_size == 0 || input_size > ctx->capacity || skip < 0 || (size_t)skip >= input_size) {
+        return ZX7_ERR_INPUT;
+    }
+
+    result = compress(ctx, input_data, input_size, skip, output_size, delta);
+    if (result != ZX7_OK) {
+        return result;
+    }
+    *output_data = ctx->output_data;
+    return ZX7_OK;
+}
+
+int zx7_compress(ZX7Context *ctx, const unsigned char *input_data, size_t input_size, long skip, unsigned char **output_data, size_t *output_size, long *delta) {
+    int result;
+
+    result = zx7_parse(ctx, input_data, input_size, skip);
+    if (result != ZX7_OK) {
+        return result;
+    }
+    return zx7_write(ctx, input_data, input_size, skip, output_data, output_size, delta);
+}
+
+void zx7_destroy(ZX7Context *ctx) {
+    if (ctx) {
+        zx7_release(ctx);
+        free(ctx->output_data);
+        free(ctx);
+    }
+}
@@ -23,15 +23,177 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stddef.h>
+#include <stdint.h>
+
+/* bump whenever a change can alter the compressed output, it keys caches */
+#define ZX7_ENCODER_VERSION "zx7-1"
+
 #define MAX_OFFSET  2176  /* range 1..2176 */
 #define MAX_LEN    65536  /* range 2..65536 */
 
-typedef struct optimal_t {
-    size_t bits;
-    int offset;
-    int len;
-} Optimal;
+/* positions and costs are kept in 32 bits, 9 bits per byte at worst */
+#define ZX7_MAX_INPUT  0x10000000
+
+/* match finders, both produce the same optimal parse */
+#define ZX7_MATCH_HASH    0  /* chains over the previous two bytes */
+#define ZX7_MATCH_TREE    1  /* binary tree over the window, faster on long runs, more memory */
+
+/* parsers, all writing the same stream format */
+#define ZX7_PARSE_OPTIMAL 0  /* smallest output */
+#define ZX7_PARSE_GREEDY  1  /* longest match at every step, linear time */
+#define ZX7_PARSE_LAZY    2  /* greedy, but defers a match by one byte if that finds a longer one */
+
+/* decoding time weight for the optimal parse, see optimize_speed.c */
+#define ZX7_SPEED_ONE  1024  /* ctx->speed for one bit per dzx7 T-state */
+
+/* Z80 decoders the T-state model knows, asm/dzx7_*.asm */
+#define ZX7_DZX7_STANDARD 0  /* 69 bytes */
+#define ZX7_DZX7_TURBO    1  /* 88 bytes */
+#define ZX7_DZX7_MEGA     2  /* 118 bytes */
+
+/* return codes */
+#define ZX7_OK            0
+#define ZX7_ERR_MEMORY   -1  /* allocation failed */
+#define ZX7_ERR_INPUT    -2  /* empty, too large, or skip beyond end of input */
+
+/* compressor counters, only counted in builds with -DZX7_PROFILE (make
+   PROFILE=1) and free otherwise. They add up over every compression a
+   context does until the caller clears them. */
+#define ZX7_SEARCH_BUCKETS 13  /* candidates per position: 0, 1, 2-3, 4-7, ..., 2048 and up */
+#define ZX7_LEN_BUCKETS    16  /* match lengths 2, 3-4, 5-8, ..., 32769-65536 */
+#define ZX7_OFFSET_BUCKETS 12  /* offsets 1, 2-3, 4-7, ..., 1024-2047, 2048-2176 */
+
+typedef struct zx7_profile_t {
+    /* match finders of the optimal parse */
+    uint64_t positions;         /* positions searched */
+    uint64_t candidates;        /* offsets tried: hash chain links or tree nodes visited */
+    uint64_t longest_search;    /* most candidates at one position */
+    uint64_t compared;          /* bytes compared while extending matches */
+    uint64_t window_cuts;       /* searches ended by a candidate beyond MAX_OFFSET */
+    uint64_t search_hist[ZX7_SEARCH_BUCKETS];
+
+    /* the parse that was written */
+    uint64_t literals;
+    uint64_t matches;
+    uint64_t long_offsets;      /* matches with an offset above 128, 4 bits more */
+    uint64_t len_hist[ZX7_LEN_BUCKETS];
+    uint64_t offset_hist[ZX7_OFFSET_BUCKETS];
+} ZX7Profile;
+
+#ifdef ZX7_PROFILE
+#define ZX7_COUNT(ctx, counter, n) ((ctx)->profile.counter += (n))
+#define ZX7_PROFILE_ONLY(code) code
+#else
+#define ZX7_COUNT(ctx, counter, n) ((void)0)
+#define ZX7_PROFILE_ONLY(code)
+#endif
+
+/* extends a backward match of len bytes ending at a and b, up to limit */
+typedef size_t (*ZX7MatchBack)(const unsigned char *a, const unsigned char *b, size_t len, size_t limit);
+
+/* compressor context: owns every buffer used by one compression at a time, so
+   separate contexts can be used concurrently from different threads. The
+   workspace only ever grows and is reused by later compressions. */
+typedef struct zx7_context_t {
+    /* optimizer */
+    int parse;                  /* ZX7_PARSE_*, set before compressing */
+    int match_finder;           /* ZX7_MATCH_*, for the optimal parse */
+    uint32_t speed;             /* bits per decoder T-state, times ZX7_SPEED_ONE; 0 for size only */
+    ZX7MatchBack match_back;    /* picked for the running CPU at creation */
+    uint32_t *optimal_bits;     /* per position: cost of the best parse up to it */
+    uint16_t *optimal_offset;   /* per position: offset of its last match, 0 if literal */
+    uint16_t *optimal_len;      /* per position: length-1 of its last match, 0 if literal */
+    size_t capacity;            /* largest input the workspace can hold */
+    uint64_t *optimal_cost;     /* per position: weighted cost, when speed is set */
+    size_t cost_capacity;
+
+    /* hash chain match finder */
+    uint32_t *min;
+    uint32_t *max;
+    uint32_t *matches;
+    uint32_t *match_slots;
+    size_t hash_capacity;
+
+    /* binary tree match finder */
+    uint32_t *tree_left;        /* per position: older, smaller/larger subtrees */
+    uint32_t *tree_right;
+    uint32_t *tree_pos;         /* per offset: position it was last compared at */
+    uint32_t *tree_len;         /* per offset: match length found there */
+    uint32_t *tree_min;         /* sparse table of the cheapest position per range */
+    size_t tree_capacity;
+
+    /* bit writer */
+    unsigned char *output_data;
+    size_t output_capacity;
+    size_t output_index;
+    size_t bit_index;
+    int bit_mask;
+    long diff;
+
+    /* accounting */
+    size_t allocated_bytes;     /* currently held by the context */
+    size_t peak_bytes;          /* high-water mark of allocated_bytes */
+    ZX7Profile profile;         /* present either way, so the layout never depends on ZX7_PROFILE */
+} ZX7Context;
+
+ZX7Context *zx7_create(void);
+
+/* compresses input_data[skip..input_size), using input_data[0..skip) as a
+   dictionary; on success *output_data points to a buffer owned by the context
+   that stays valid until the next call to zx7_compress() or zx7_destroy() */
+int zx7_compress(ZX7Context *ctx, const unsigned char *input_data, size_t input_size, long skip, unsigned char **output_data, size_t *output_size, long *delta);
+
+/* the two halves of zx7_compress(): zx7_parse() leaves the chosen parse in
+   the optimal_* arrays, where a caller may also assemble one itself (the
+   path back from input_size-1 to skip, and the total cost at input_size-1),
+   and zx7_write() encodes whatever parse the arrays hold */
+int zx7_parse(ZX7Context *ctx, const unsigned char *input_data, size_t input_size, long skip);
+
+int zx7_write(ZX7Context *ctx, const unsigned char *input_data, size_t input_size, long skip, unsigned char **output_data, size_t *output_size, long *delta);
+
+void zx7_destroy(ZX7Context *ctx);
+
+/* sizes the workspace for inputs up to input_size bytes in one go, so a run
+   over many files can allocate once up front for the largest of them */
+int zx7_reserve(ZX7Context *ctx, size_t input_size);
+
+int zx7_reserve_output(ZX7Context *ctx, size_t output_size);
+
+/* frees the workspace of a context but keeps the last output */
+void zx7_release(ZX7Context *ctx);
+
+int count_bits(int offset, int len);
+
+/* dzx7_standard T-states for a match, or for a literal with offset 0, in
+   eighths of a T-state */
+int count_t8(int offset, int len);
+
+/* T-states a decoder (ZX7_DZX7_*) takes to decode a whole stream, up to and
+   including its RET; 0 if the stream is truncated */
+uint64_t zx7_tstates(const unsigned char *data, size_t size, int decoder);
+
+size_t zx7_tree_levels(size_t input_size);
+
+/* whether the library was built with ZX7_PROFILE, i.e. ctx->profile is filled in */
+int zx7_profiling(void);
+
+/* counts one search that tried `candidates` offsets, and one match of the parse */
+void zx7_profile_search(ZX7Profile *profile, uint64_t candidates);
+
+void zx7_profile_match(ZX7Profile *profile, int offset, int len);
+
+/* adds the counters of part to total, e.g. over the segments of one input */
+void zx7_profile_add(ZX7Profile *total, const ZX7Profile *part);
+
+ZX7MatchBack zx7_match_back(void);
+
+int optimize(ZX7Context *ctx, const unsigned char *input_data, size_t input_size, long skip);
+
+int optimize_speed(ZX7Context *ctx, const unsigned char *input_data, size_t input_size, long skip);
+
+int optimize_tree(ZX7Context *ctx, const unsigned char *input_data, size_t input_size, long skip);
 
-Optimal *optimize(unsigned char *input_data, size_t input_size, long skip);
+int optimize_fast(ZX7Context *ctx, const unsigned char *input_data, size_t input_size, long skip, int lazy);
 
-unsigned char *compress(Optimal *optimal, unsigned char *input_data, size_t input_size, long skip, size_t *output_size, long *delta);
+int compress(ZX7Context *ctx, const unsigned char *input_data, size_t input_size, long skip, size_t *output_size, long *delta);